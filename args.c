@@ -20,12 +20,30 @@
  *   count=N
  *   skip=N     -- skip N input blocks
  *   seek=N     -- skip N output blocks before first write
- *   if=FILE
+ *   if=FILE[,FILE...] -- inputs are concatenated
  *   of=FILE
  *   iflag=nonblock
  *   oflag=nonblock,excl,sync,nocreat,notrunc,trunc
+ *   conv=noerror,sync -- zero fill unreadable sectors and go on
+ *   badmap=FILE       -- conv=noerror: write the unreadable ranges
  *   size=N     -- alias for bs=1, count=N
  *   iosize=N   -- do I/O in chunks of 'iosize' bytes.
+ *   rate=N     -- limit copy bandwidth to N bytes/sec
+ *   burst=N    -- allow bursts of up to N bytes above 'rate'
+ *   status=json -- print final stats as JSON
+ *   status_interval=T -- print stats every T (10s, 500ms, 1m etc.)
+ *   metrics=FILE      -- write a prometheus textfile every metrics_interval
+ *   metrics_shm=FILE  -- publish stats in a mmap'd struct
+ *   metrics_interval=T
+ *   trace=FILE        -- write a chrome trace of I/O and queue events
+ *   trace_size=N      -- max events kept per thread
+ *
+ * And a bare word picks the mode:
+ *   wipe       -- fill seek=..count= of the output with if=gen:...
+ *   scan       -- read the input to of=null: and map the read latency
+ *   burnin     -- write seek=..count= of the output with if=gen:...
+ *                 and read it back to verify
+ *   heatmap=FILE      -- scan: write the latency map as CSV
  */
 
 #include <stdio.h>
@@ -37,6 +55,7 @@
 
 #include "error.h"
 #include "utils/utils.h"
+#include "utils/new.h"
 
 #include "args.h"
 #include "fastdd.h"
@@ -62,22 +81,67 @@ typedef struct arg arg;
 #define TYP_S       2   // string
 #define TYP_VA      3   // var arg list (comma separated)
 #define TYP_BOOL    4   // boolean (0 or 1)
+#define TYP_IN      5   // list of input files (comma separated)
+#define TYP_ST      6   // status= keywords (comma separated)
+#define TYP_DUR     7   // uint64 duration with a suffix (ms,s,m,h); ns
 
 static const arg Validargs[] =
 {
       {"bs",     TYP_SZ,   offsetof(Args, bs)}
-    , {"if",     TYP_S,    offsetof(Args, infile)}
+    , {"if",     TYP_IN,   offsetof(Args, inputs)}
     , {"of",     TYP_S,    offsetof(Args, outfile)}
+    , {"engine", TYP_S,    offsetof(Args, engine)}
     , {"skip",   TYP_I,    offsetof(Args, skip)}
     , {"seek",   TYP_I,    offsetof(Args, seek)}
     , {"iosize", TYP_SZ,   offsetof(Args, iosize)}
     , {"count",  TYP_SZ,   offsetof(Args, count)}
     , {"iflag",  TYP_VA,   offsetof(Args, iflag)}
     , {"oflag",  TYP_VA,   offsetof(Args, oflag)}
+    , {"conv",   TYP_VA,   offsetof(Args, conv)}
+    , {"badmap", TYP_S,    offsetof(Args, badmap)}
+    , {"rate",   TYP_SZ,   offsetof(Args, rate)}
+    , {"burst",  TYP_SZ,   offsetof(Args, burst)}
+    , {"status", TYP_ST,   offsetof(Args, status)}
+    , {"status_interval", TYP_DUR, offsetof(Args, status_intv)}
+    , {"metrics",          TYP_S,  offsetof(Args, metrics)}
+    , {"metrics_shm",      TYP_S,  offsetof(Args, metrics_shm)}
+    , {"metrics_interval", TYP_DUR, offsetof(Args, metrics_intv)}
+    , {"trace",            TYP_S,  offsetof(Args, trace)}
+    , {"trace_size",       TYP_SZ, offsetof(Args, trace_size)}
+    , {"heatmap",          TYP_S,  offsetof(Args, heatmap)}
 
     , {0, 0, 0}
 };
 
+// Bare words that pick Args::mode; indexed by MODE_xxx
+static const char *Modes[] =
+{
+      "copy"
+    , "wipe"
+    , "scan"
+    , "burnin"
+    , 0
+};
+
+// Amount of the next input we ask the kernel to read ahead
+#define PREFETCH_SIZE   (4 * 1048576)
+
+// iosize when the devices have nothing better to say
+#define IOSIZE_DEFAULT  65536
+
+// Largest iosize we derive for a raw block device
+#define IOSIZE_BLKMAX   1048576
+
+// Smallest iosize we derive for spinning and solid state devices
+#define IOSIZE_HDD      1048576
+#define IOSIZE_SSD      262144
+
+// Cap on the buffers in flight (see tune_io())
+#define IO_MAXMEM       (64 * 1048576)
+
+// Round 'x' up to a multiple of 'a'
+#define _Align(x, a)    ((((x) + (a) - 1) / (a)) * (a))
+
 struct flag {
     const char *str;
     int val;
@@ -103,10 +167,19 @@ static const struct flag Flags[] = {
 };
 
 static int  parse_flags(Args *aa, size_t off, char *str, char *opt);
+static int  parse_status(Args *aa, size_t off, char *str, char *opt);
+static int  parse_duration(const char *str, uint64_t *p_ns);
+static int  add_inputs(Args *aa, char *str);
+static void open_inputs(Args *aa);
+static void set_input(Args *aa, int i);
 static void filldefault(Args *a);
 static int  openfile(struct stat *p_st, const char *fn, int flags, mode_t mode);
 static void xstat(struct stat *st, int fd);
+static void tune_io(Args *aa);
 static const arg* findarg(const char *s);
+static int  findmode(const char *s);
+static void out_range(Args *aa);
+static void scan_input(Args *aa);
 
 /*
  * Parse command line args of the form "key=value" and populate
@@ -116,23 +189,29 @@ int
 Parse_args(Args *aa, int argc, char * const argv[])
 {
     char tmp[1024];
-    char *av[8];
-    int i,
-        n;
+    int i;
 
     filldefault(aa);
 
     for (i = 0; i < argc; i++) {
         strcopy(tmp, sizeof tmp, argv[i]);
-        n = strsplit_quick(av, 2, tmp, "=", 0);
 
-        if (n != 2) {
+        // Split at the first '='; values may have one too (e.g.,
+        // if=gen:entropy=50%).
+        char * v = strchr(tmp, '=');
+        if (!v) {
+            int m = findmode(tmp);
+
+            if (m >= 0) {
+                aa->mode = m;
+                continue;
+            }
             die("missing '=' in argument %s", argv[i]);
             return -EINVAL;
         }
 
-        char * s = av[0];
-        char * v = av[1];
+        char * s = tmp;
+        *v++ = 0;
         const arg* a = findarg(s);
         if (!a) {
             die("invalid option %s", s);
@@ -173,6 +252,23 @@ Parse_args(Args *aa, int argc, char * const argv[])
                 if (parse_flags(aa, a->off, v, s) < 0) return -EINVAL;
                 break;
 
+            case TYP_IN:
+                if (add_inputs(aa, v) < 0) return -EINVAL;
+                break;
+
+            case TYP_ST:
+                if (parse_status(aa, a->off, v, s) < 0) return -EINVAL;
+                break;
+
+            case TYP_DUR:
+                if (parse_duration(v, &u) < 0) {
+                    die("argument %s to %s is not a duration", v, s);
+                    return -EINVAL;
+                }
+
+                *pU64(pU8(aa)+a->off) = u;
+                break;
+
             case TYP_BOOL:
                 if (0 == strcasecmp("true", v) || 0 == strcasecmp("yes", v) || 0 == strcmp("1", v)) {
                     r = 1;
@@ -192,18 +288,56 @@ Parse_args(Args *aa, int argc, char * const argv[])
     // XXX Overflow check?
     aa->insize = aa->bs * aa->count;
 
+    // Always convert to byte offsets.
+    aa->skip *= aa->bs;
+    aa->seek *= aa->bs;
+
     // some flags are useless for iflag
     aa->iflag &= ~(O_EXCL|O_TRUNC|O_WRONLY|O_RDWR);
 
-    if (strlen(aa->infile) > 0 && 0 != strcmp("-", aa->infile)) {
-        aa->ifd = openfile(&aa->ist, aa->infile,  aa->iflag, 0);
-    } else {
-        strcopy(aa->infile, sizeof aa->infile, "<STDIN>");
-        aa->ifd = 0;
-        xstat(&aa->ist, 0);
+    // We don't pad short reads the way dd does; 'sync' only spells
+    // out what noerror does anyway.
+    if ((aa->conv & (CONV_SYNC|CONV_NOERROR)) == CONV_SYNC)
+        die("conv=sync needs noerror; noerror always zero fills unreadable sectors");
+
+    // A wipe fills with zeros and a burnin with random data unless
+    // told otherwise.
+    if (aa->ninputs == 0 && (aa->mode == MODE_WIPE || aa->mode == MODE_BURNIN)) {
+        char zero[] = "gen:zero";
+        char rnd[]  = "gen:random";
+
+        add_inputs(aa, aa->mode == MODE_WIPE ? zero : rnd);
     }
 
-    if (strlen(aa->outfile) > 0 && 0 != strcmp("-", aa->outfile)) {
+    open_inputs(aa);
+
+    if (aa->mode == MODE_WIPE || aa->mode == MODE_BURNIN) {
+        const char *m = Modes[aa->mode];
+
+        if (aa->gen.type == GEN_NONE || aa->ninputs > 1)
+            die("%s: if= must be one generator (gen:zero, gen:pattern ..)", m);
+        if (strlen(aa->outfile) == 0 || 0 == strcmp("-", aa->outfile) || 0 == strcmp("null:", aa->outfile))
+            die("%s: needs of=FILE or of=DEVICE", m);
+        if (aa->mode == MODE_BURNIN && aa->gen.type == GEN_ZERO)
+            die("burnin: gen:zero can't tell one block from another");
+
+        // We read back what we write.
+        if (aa->mode == MODE_BURNIN) aa->oflag = (aa->oflag & ~O_WRONLY) | O_RDWR;
+    } else if (aa->mode == MODE_SCAN) {
+        scan_input(aa);
+    } else if (aa->gen.type != GEN_NONE) {
+        if (aa->ninputs > 1) die("if=gen: can't be combined with other inputs");
+        if (aa->insize == 0) die("if=gen: needs count=");
+    }
+
+    /*
+     * of=null: still gets an fd (/dev/null) so that engines which
+     * must write somewhere (splice) can; the others skip the write.
+     */
+    if (0 == strcmp("null:", aa->outfile)) {
+        aa->onull = 1;
+        aa->ofd   = openfile(&aa->ost, "/dev/null", O_WRONLY, 0);
+    } else if (strlen(aa->outfile) > 0 && 0 != strcmp("-", aa->outfile)) {
         aa->ofd = openfile(&aa->ost, aa->outfile,  aa->oflag, 0600);
     } else {
         strcopy(aa->outfile, sizeof aa->outfile, "<STDOUT>");
@@ -211,30 +345,223 @@ Parse_args(Args *aa, int argc, char * const argv[])
         xstat(&aa->ost, 1);
     }
 
-    aa->ipipe = ispipe(aa->ifd);
     aa->opipe = ispipe(aa->ofd);
 
-    if ((aa->skip * aa->bs) > aa->insize)
-        die("%" PRIu64 "input blocks skips over all input", aa->skip);
+    if (aa->mode == MODE_WIPE || aa->mode == MODE_BURNIN) out_range(aa);
 
-    if (!aa->ipipe) {
-        if (aa->insize == 0) aa->insize = aa->ist.st_size;
+    /*
+     * skip and count apply to the logical concatenation of all the
+     * inputs. We can only validate them when every input has a
+     * known size.
+     */
+    uint64_t total = 0;
+    for (i = 0; i < aa->ninputs; i++) {
+        Input *in = &aa->inputs[i];
 
-        if (S_ISREG(aa->ist.st_mode) || S_ISBLK(aa->ist.st_mode)) {
-            if (aa->insize > aa->ist.st_size)
-                die("%s: input size is greater than file size %" PRIu64 "",
-                        aa->infile, aa->ist.st_size);
+        if (in->pipe || !(S_ISREG(in->st.st_mode) || S_ISBLK(in->st.st_mode))) {
+            total = 0;
+            break;
         }
+        total += in->st.st_size;
+    }
+
+    if (aa->mode == MODE_SCAN && total == 0) die("scan: %s has no size", aa->infile);
 
-        if ((aa->skip * aa->bs) > aa->ist.st_size)
-            die("%s: %" PRIu64 "input blocks skips past EOF", aa->infile, aa->skip);
+    if (total > 0) {
+        if (aa->skip > total)
+            die("%s: skip of %" PRIu64 " bytes is past EOF", aa->infile, aa->skip);
+
+        if (aa->insize == 0) {
+            aa->insize = total - aa->skip;
+        } else if ((aa->skip + aa->insize) > total) {
+            die("%s: input size is greater than file size %" PRIu64 "",
+                    aa->infile, total);
+        }
     }
 
+    for (i = 0; i < aa->ninputs; i++) {
+        Input *in = &aa->inputs[i];
 
-    // Always convert to byte offsets.
-    aa->skip *= aa->bs;
-    aa->seek *= aa->bs;
+        if (in->fd < 0 || Devinfo_get(&in->dev, in->fd) < 0) {
+            memset(&in->dev, 0, sizeof in->dev);
+            in->dev.rotational = -1;
+        }
+    }
+    if (Devinfo_get(&aa->odev, aa->ofd) < 0) {
+        memset(&aa->odev, 0, sizeof aa->odev);
+        aa->odev.rotational = -1;
+    }
+
+    tune_io(aa);
+
+    /*
+     * The engines charge the token bucket after each I/O; an I/O
+     * block can't be larger than the burst or we'd blow through the
+     * limit. Default burst is 100ms worth of the rate. O_DIRECT
+     * I/O stays a multiple of the alignment; the burst is raised to
+     * at least one such block.
+     */
+    if (aa->rate > 0) {
+        uint64_t al = aa->align;
+
+        if (aa->burst == 0) {
+            aa->burst = aa->rate / 10;
+            if (aa->burst < aa->iosize) aa->burst = aa->iosize;
+            if (al > 0) aa->burst = (aa->burst / al) * al;
+        }
+        if (aa->iosize > aa->burst) aa->iosize = aa->burst;
+        if (al > 0) {
+            aa->iosize = (aa->iosize / al) * al;
+            if (aa->iosize < al)    aa->iosize = al;
+            if (aa->burst  < al)    aa->burst  = al;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Derive the defaults that depend on the devices at either end:
+ *
+ *  o the strategy: if any device spins, one sequential stream with
+ *    large I/O and aggressive readahead; if they are all solid
+ *    state, IO_SHARDS concurrent shards with moderate I/O.
+ *
+ *  o iosize (unless given): the optimal I/O size if a device has
+ *    one, and at least IOSIZE_HDD or IOSIZE_SSD per the strategy. On
+ *    unknown devices, a raw block device gets one full request
+ *    (max_sectors_kb, at most 1M). Always a multiple of the
+ *    physical sector.
+ *
+ *  o O_DIRECT alignment: the largest logical sector size of the
+ *    direct endpoints; iosize is rounded up to it.
+ *
+ *  o output alignment of a block device: its optimal I/O size (the
+ *    RAID stripe) or else its physical sector. A write that isn't
+ *    aligned to it makes the device read-modify-write.
+ *
+ *  o buffers in flight: no more than the shallowest device queue
+ *    (nr_requests) and no more than IO_MAXMEM of buffers.
+ */
+static void
+tune_io(Args *aa)
+{
+    uint64_t io  = aa->iosize ? aa->iosize : IOSIZE_DEFAULT;
+    uint32_t pbs = 0, al = 0, qd = 0;
+    int rot = -1;
+    int i;
+
+    for (i = 0; i <= aa->ninputs; i++) {
+        int out = i == aa->ninputs;
+        const Devinfo *d     = out ? &aa->odev : &aa->inputs[i].dev;
+        const struct stat *st = out ? &aa->ost : &aa->inputs[i].st;
+        int direct = 0;
+
+#ifdef O_DIRECT
+        direct = (out ? aa->oflag : aa->iflag) & O_DIRECT;
+#endif
+        if (direct) {
+            uint32_t lbs = d->lbs ? d->lbs : 512;
+            if (lbs > al) al = lbs;
+        }
+
+        if (d->pbs > pbs) pbs = d->pbs;
+        if (d->nr_requests > 0 && (qd == 0 || d->nr_requests < qd)) qd = d->nr_requests;
+
+        // One spinning device makes the whole copy seek bound.
+        if (d->rotational > rot) rot = d->rotational;
+
+        if (aa->iosize > 0) continue;
+
+        if (d->ioopt > io) io = d->ioopt;
+        if (S_ISBLK(st->st_mode) && d->rotational < 0 && d->maxio > io)
+            io = d->maxio > IOSIZE_BLKMAX ? IOSIZE_BLKMAX : d->maxio;
+    }
+
+    if (aa->iosize == 0) {
+        if (rot == 1 && io < IOSIZE_HDD) io = IOSIZE_HDD;
+        if (rot == 0 && io < IOSIZE_SSD) io = IOSIZE_SSD;
+        if (pbs > 0)                     io = _Align(io, pbs);
+    }
+    if (al > 0) io = _Align(io, al);
+
+    aa->iosize     = io;
+    aa->align      = al;
+    aa->rotational = rot;
 
+    aa->oalign = 0;
+    if (S_ISBLK(aa->ost.st_mode) && !aa->onull)
+        aa->oalign = aa->odev.ioopt ? aa->odev.ioopt : aa->odev.pbs;
+
+    // The short head chunk mustn't break O_DIRECT on the input.
+    if (aa->oalign > 0 && al > 0 && ((aa->seek % aa->oalign) % al) != 0) aa->oalign = 0;
+
+    if (qd == 0 || qd > IO_QDEPTH)  qd = IO_QDEPTH;
+    if (qd * io > IO_MAXMEM)        qd = IO_MAXMEM / io;
+    if (qd < 4)                     qd = 4;
+    aa->qdepth = qd;
+
+    aa->shards = 1;
+    if (rot == 0) aa->shards = qd < IO_SHARDS ? qd : IO_SHARDS;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    // Ask for a bigger readahead window on the spinning inputs.
+    if (rot == 1) {
+        for (i = 0; i < aa->ninputs; i++) {
+            Input *in = &aa->inputs[i];
+
+            if (!in->pipe && (S_ISREG(in->st.st_mode) || S_ISBLK(in->st.st_mode)))
+                posix_fadvise(in->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+    }
+#endif
+}
+
+
+/*
+ * Close all the fds held by 'aa'.
+ */
+void
+Args_close(Args *aa)
+{
+    int i;
+
+    for (i = 0; i < aa->ninputs; i++) {
+        Input *in = &aa->inputs[i];
+        if (in->fd > 0) close(in->fd);
+        in->fd = -1;
+    }
+
+    if (aa->ofd > 0) close(aa->ofd);
+
+    aa->ifd = aa->ofd = -1;
+}
+
+
+/*
+ * Free resources held by 'aa'; the inputs outlive Args_close() for
+ * the final statistics.
+ */
+void
+Args_free(Args *aa)
+{
+    DEL(aa->inputs);
+    aa->inputs  = 0;
+    aa->ninputs = 0;
+}
+
+
+/*
+ * Make the next input current. Return 0 if there is one, -ENOENT
+ * when the inputs are exhausted.
+ */
+int
+Next_input(Args *aa)
+{
+    if ((aa->curin + 1) >= aa->ninputs) return -ENOENT;
+
+    set_input(aa, aa->curin + 1);
     return 0;
 }
 
@@ -315,6 +642,21 @@ parse_flags(Args *aa, size_t off, char *str, char *ostr)
     for (i = 0; i < r; i++) {
         char * s = av[i];
 
+        // conv= has its own keywords
+        if (off == offsetof(Args, conv)) {
+            if (0 == strcasecmp("noerror", s)) {
+                v |= CONV_NOERROR;
+                continue;
+            }
+            if (0 == strcasecmp("sync", s)) {
+                v |= CONV_SYNC;
+                continue;
+            }
+
+            warn("unknown option '%s' for '%s'", s, ostr);
+            return -EINVAL;
+        }
+
         if (0 == strcasecmp("excl", s)) {
             v |= O_EXCL;
             continue;
@@ -347,6 +689,12 @@ parse_flags(Args *aa, size_t off, char *str, char *ostr)
             continue;
         }
 
+        // Not an open(2) flag; output only.
+        if (0 == strcasecmp("discard", s) && off == offsetof(Args, oflag)) {
+            aa->discard = 1;
+            continue;
+        }
+
         if ((0 == strcasecmp("nocreat", s)) ||
             (0 == strcasecmp("nocreate", s))) {
             v &= ~O_CREAT;
@@ -370,6 +718,178 @@ parse_flags(Args *aa, size_t off, char *str, char *ostr)
 }
 
 
+/*
+ * parse status=a,b,c
+ */
+static int
+parse_status(Args *aa, size_t off, char *str, char *ostr)
+{
+    static const struct flag Status[] = {
+        {"json", ST_JSON},
+        {"perf", ST_PERF},
+        {"bottleneck", ST_BOTTLENECK},
+        {"syscalls", ST_SYSCALLS},
+
+        {0, 0}
+    };
+
+    char *av[8];
+    int r = strsplit_quick(av, 8, str, ",", 1);
+
+    if (r < 0) {
+        warn("too many options for %s", ostr);
+        return -EINVAL;
+    }
+
+    int i;
+    uint32_t v = *pU32(pU8(aa)+off);
+    for (i = 0; i < r; i++) {
+        const struct flag *x = Status;
+
+        for (; x->str; x++) {
+            if (0 == strcasecmp(x->str, av[i])) break;
+        }
+
+        if (!x->str) {
+            warn("unknown option '%s' for '%s'", av[i], ostr);
+            return -EINVAL;
+        }
+        v |= x->val;
+    }
+
+    *pU32(pU8(aa)+off) = v;
+    return 0;
+}
+
+
+/*
+ * parse a duration of the form N[suffix] where suffix is one of
+ * ms, s, m, h (default: s). The result is in nanoseconds.
+ */
+static int
+parse_duration(const char *str, uint64_t *p_ns)
+{
+    static const struct {
+        const char *suff;
+        uint64_t    mult;
+    } Units[] = {
+          {"ms", _Millisecond(1)}
+        , {"s",  _Second(1)}
+        , {"m",  _Minute(1)}
+        , {"h",  _Minute(60)}
+        , {"",   _Second(1)}
+        , {0, 0}
+    };
+
+    char *end = 0;
+    double v  = strtod(str, &end);
+
+    if (end == str || v < 0.0) return -EINVAL;
+
+    int i;
+    for (i = 0; Units[i].suff; i++) {
+        if (0 == strcmp(Units[i].suff, end)) {
+            *p_ns = (uint64_t)(v * Units[i].mult);
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+
+/*
+ * parse if=a,b,c; each call appends to the list of inputs.
+ */
+static int
+add_inputs(Args *aa, char *str)
+{
+    char *av[MAX_INPUTS];
+    int r = strsplit_quick(av, MAX_INPUTS, str, ",", 1);
+
+    if (r < 0 || (aa->ninputs + r) > MAX_INPUTS) {
+        warn("too many inputs; max %d", MAX_INPUTS);
+        return -EINVAL;
+    }
+
+    aa->inputs = RENEWA(Input, aa->inputs, aa->ninputs + r);
+
+    int i;
+    for (i = 0; i < r; i++) {
+        Input *in = &aa->inputs[aa->ninputs++];
+
+        memset(in, 0, sizeof *in);
+        strcopy(in->name, sizeof in->name, av[i]);
+    }
+    return 0;
+}
+
+
+/*
+ * Open every input; we do this upfront so that switching from one
+ * input to the next doesn't stall the copy.
+ */
+static void
+open_inputs(Args *aa)
+{
+    int i;
+
+    if (aa->ninputs == 0) {
+        char stdin_[] = "-";
+        add_inputs(aa, stdin_);
+    }
+
+    for (i = 0; i < aa->ninputs; i++) {
+        Input *in = &aa->inputs[i];
+
+        if (0 == strncmp("gen:", in->name, 4)) {
+            if (Gen_parse(&aa->gen, in->name + 4) < 0)
+                die("invalid generator %s; want gen:zero|pattern|random[:seed]|entropy=N%%[:seed]",
+                        in->name);
+            in->fd = -1;
+            continue;
+        }
+
+        if (strlen(in->name) > 0 && 0 != strcmp("-", in->name)) {
+            in->fd = openfile(&in->st, in->name, aa->iflag, 0);
+        } else {
+            strcopy(in->name, sizeof in->name, "<STDIN>");
+            in->fd = 0;
+            xstat(&in->st, 0);
+        }
+
+        in->pipe = ispipe(in->fd);
+    }
+
+    set_input(aa, 0);
+}
+
+
+/*
+ * Make input 'i' the current one and hint the kernel to start
+ * reading the one after it.
+ */
+static void
+set_input(Args *aa, int i)
+{
+    Input *in = &aa->inputs[i];
+
+    aa->curin = i;
+    aa->ifd   = in->fd;
+    aa->ipipe = in->pipe;
+    aa->ist   = in->st;
+    strcopy(aa->infile, sizeof aa->infile, in->name);
+
+#ifdef POSIX_FADV_WILLNEED
+    if ((i + 1) < aa->ninputs) {
+        Input *nx = &aa->inputs[i+1];
+
+        if (!nx->pipe && S_ISREG(nx->st.st_mode))
+            posix_fadvise(nx->fd, 0, PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+    }
+#endif
+}
+
+
 static void
 filldefault(Args *a)
 {
@@ -377,12 +897,94 @@ filldefault(Args *a)
     a->bs = 512;   // same as dd
     a->infile[0]  = 0;  // stdin
     a->outfile[0] = 0;  // stdout
-    a->iosize     = 65536; // 64k blocks of I/O
+    a->iosize     = 0;     // see tune_io()
+    a->metrics_intv = _Second(10);
+    a->trace_size   = 262144;
+    strcopy(a->engine, sizeof a->engine, "auto");
 
     a->iflag = O_RDONLY;
     a->oflag = O_CREAT | O_WRONLY;
 }
 
+/*
+ * Return the MODE_xxx for the bare word 's' or -1.
+ */
+static int
+findmode(const char *s)
+{
+    int i;
+
+    for (i = 0; Modes[i]; i++) {
+        if (0 == strcmp(Modes[i], s)) return i;
+    }
+    return -1;
+}
+
+
+/*
+ * A wipe or burnin writes seek= .. seek+count of the output; without
+ * count=, all of it from seek= to the end. Block devices are done
+ * with O_DIRECT.
+ */
+static void
+out_range(Args *aa)
+{
+    const char *m = Modes[aa->mode];
+    uint64_t sz   = aa->ost.st_size;
+
+    if (aa->opipe || !(S_ISREG(aa->ost.st_mode) || S_ISBLK(aa->ost.st_mode)))
+        die("%s: %s is not a file or block device", m, aa->outfile);
+
+    if (aa->insize == 0) {
+        if (sz <= aa->seek) die("%s: %s: nothing past %" PRIu64 " bytes; needs count=",
+                                 m, aa->outfile, aa->seek);
+        aa->insize = sz - aa->seek;
+    } else if (S_ISBLK(aa->ost.st_mode) && (aa->seek + aa->insize) > sz) {
+        die("%s: %s: range is past the end of the device (%" PRIu64 " bytes)", m, aa->outfile, sz);
+    }
+
+    // O_DIRECT fails unaligned I/O with EINVAL; that must not be
+    // taken for bad media.
+    if (aa->mode == MODE_BURNIN && S_ISBLK(aa->ost.st_mode)) {
+        uint32_t lbs = aa->odev.lbs ? aa->odev.lbs : 512;
+
+        if ((aa->seek | aa->insize) & (lbs - 1))
+            die("%s: %s: range is not sector aligned (%u bytes)", m, aa->outfile, lbs);
+    }
+
+#ifdef O_DIRECT
+    if (aa->mode == MODE_BURNIN && S_ISBLK(aa->ost.st_mode) &&
+            fcntl(aa->ofd, F_SETFL, fcntl(aa->ofd, F_GETFL) | O_DIRECT) == 0)
+        aa->oflag |= O_DIRECT;
+#endif
+}
+
+
+/*
+ * A scan reads one file or device to of=null:; devices are read
+ * with O_DIRECT so that we time the disk and not the page cache.
+ */
+static void
+scan_input(Args *aa)
+{
+    Input *in = &aa->inputs[0];
+
+    if (aa->ninputs != 1 || aa->gen.type != GEN_NONE || in->pipe ||
+            !(S_ISREG(in->st.st_mode) || S_ISBLK(in->st.st_mode)))
+        die("scan: if= must be one file or block device");
+
+    if (strlen(aa->outfile) > 0 && 0 != strcmp("null:", aa->outfile))
+        die("scan: reads only; of= must be null: or left out");
+
+    strcopy(aa->outfile, sizeof aa->outfile, "null:");
+
+#ifdef O_DIRECT
+    if (S_ISBLK(in->st.st_mode) && fcntl(in->fd, F_SETFL, fcntl(in->fd, F_GETFL) | O_DIRECT) == 0)
+        aa->iflag |= O_DIRECT;
+#endif
+}
+
+
 static const arg*
 findarg(const char *s)
 {
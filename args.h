@@ -27,6 +27,77 @@ extern "C" {
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include "gen.h"
+
+/*
+ * Topology of a block device (or of the device under a file). What
+ * we can't find out is left 0; rotational is -1 when unknown.
+ */
+struct Devinfo
+{
+    char     name[32];      // kernel name of the device (e.g., sda)
+    uint64_t size;          // in bytes; block devices only
+
+    uint32_t lbs;           // logical sector size
+    uint32_t pbs;           // physical sector size
+    uint32_t iomin;         // minimum I/O size
+    uint32_t ioopt;         // optimal I/O size
+    uint32_t maxio;         // largest single request (max_sectors_kb)
+    uint32_t discard;       // discard granularity; 0 => no discard
+    int      dzeroes;       // discarded blocks promise to read back zeros
+    uint64_t wzmax;         // largest write-zeroes request; 0 => none
+    uint32_t nr_requests;   // depth of the device request queue
+
+    int      rotational;
+};
+typedef struct Devinfo Devinfo;
+
+/*
+ * One input source. 'if=' takes a comma separated list of these
+ * (and may be repeated); they are streamed back to back as if they
+ * were one concatenated input.
+ */
+struct Input
+{
+    char name[PATH_MAX];
+    int  fd;
+    int  pipe;      // bool flag: set if fd is a pipe
+
+    struct stat st;
+    Devinfo dev;
+};
+typedef struct Input Input;
+
+// status= flags
+#define ST_JSON         (1 << 0)    // final stats as a JSON record
+#define ST_PERF         (1 << 1)    // CPU cost of the copy (perf counters)
+#define ST_BOTTLENECK   (1 << 2)    // where the copy spent its time
+#define ST_SYSCALLS     (1 << 3)    // syscalls per GiB and mean transfer size
+
+// conv= flags
+#define CONV_NOERROR    (1 << 0)    // go on after read errors; zero fill what's unreadable
+#define CONV_SYNC       (1 << 1)    // only with noerror, which always zero fills
+
+// Args::zfill - how a block of zeros gets to the output
+#define ZF_NONE         0   // write it
+#define ZF_SKIP         1   // skip it; the output reads back zeros
+#define ZF_ZEROOUT      2   // ask the device to zero it (no data transfer)
+
+// Args::mode - what we do; picked by a bare word on the command line
+#define MODE_COPY       0   // the default
+#define MODE_WIPE       1   // fill the output range; if= is a generator
+#define MODE_SCAN       2   // read the input to of=null: and map read latency
+#define MODE_BURNIN     3   // write if=gen:.. to the output and verify it
+
+// Max number of inputs we accept via if=
+#define MAX_INPUTS      256
+
+// Max I/O buffers in flight (Args::qdepth)
+#define IO_QDEPTH       128
+
+// Concurrent shards for solid state devices (Args::shards)
+#define IO_SHARDS       8
+
 /*
  * This represents a parsed set of "dd" args.
  *
@@ -45,24 +116,72 @@ struct Args
     int ipipe,      // bool flag: set if ifd is a pipe
         opipe;      // bool flag: set if ofd is a pipe
 
+    int mode;        // MODE_xxx
+
     uint64_t bs;     // TYP_SZ; block size in bytes
     uint64_t skip;   // TYP_I; in units of blocks
     uint64_t seek;   // TYP_I; in units of blocks
     uint64_t count;  // TYP_SZ; in units of blocks
 
     uint64_t iosize; // TYP_SZ; if we are doing mmap - then this is the map chunk size
+                     // 0 => derived from the device topology
+
+    uint32_t align;  // O_DIRECT buffer & I/O alignment; 0 => buffered I/O
+    uint32_t oalign; // output writes end on multiples of this; 0 => any (see Chunk_len())
+    uint32_t qdepth; // max I/O buffers in flight (threaded engines)
+    uint32_t shards; // concurrent streams for the shard engine
+
+    // 1 if a device at either end spins, 0 if they are solid state
+    // and -1 if we can't tell.
+    int rotational;
+
+    uint32_t status; // TYP_ST; ST_xxx flags for status=
+    uint64_t status_intv; // TYP_DUR; print stats this often (ns)
+
+    char metrics[PATH_MAX];     // TYP_S; prometheus textfile
+    char metrics_shm[PATH_MAX]; // TYP_S; mmap'd Metrics_shm
+    uint64_t metrics_intv;      // TYP_DUR; textfile update interval (ns)
+
+    char trace[PATH_MAX];       // TYP_S; chrome trace output
+    uint64_t trace_size;        // TYP_SZ; events per thread
+
+    char engine[PATH_MAX];      // TYP_S; auto or one of the engines
+    char heatmap[PATH_MAX];     // TYP_S; scan mode: CSV of the regions
+
+    uint64_t rate;   // TYP_SZ; max bytes/sec (0 => unlimited)
+    uint64_t burst;  // TYP_SZ; token bucket depth for 'rate'
 
     char infile[PATH_MAX];
     char outfile[PATH_MAX];
 
     int iflag;     // O_xxx flags
     int oflag;     // O_xxx flags
+    int conv;      // CONV_xxx flags
+
+    char badmap[PATH_MAX];      // TYP_S; conv=noerror: unreadable ranges as CSV
 
     // If this is 0, it means read till EOF.
     uint64_t  insize;
 
+    Gen gen;        // if=gen:...; gen.type is GEN_NONE for real inputs
+    int onull;      // of=null:; output is discarded
+
+    int discard;    // oflag=discard; trim the output first
+    int zfill;      // ZF_xxx; how zero blocks reach the output
+    uint64_t zlo,   // output range trimmed by oflag=discard
+             zhi;
+    uint64_t zgran; // .. granule of the trims ahead of each write; 0 => none
+
     struct stat ist,
                 ost;
+
+    Devinfo odev;   // the input devices are in inputs[]
+
+    // All the inputs; ifd, ipipe, infile and ist above mirror the
+    // current input (inputs[curin]).
+    Input *inputs;
+    int   ninputs;
+    int   curin;
 };
 typedef struct Args Args;
 
@@ -81,6 +200,23 @@ typedef struct Args Args;
  */
 int Parse_args(Args *aa, int argc, char * const argv[]);
 
+/*
+ * Close all the fds held by 'aa'.
+ */
+void Args_close(Args *aa);
+
+/*
+ * Free resources held by 'aa'; after Args_close() and after the
+ * final statistics are printed.
+ */
+void Args_free(Args *aa);
+
+/*
+ * Make the next input current. Return 0 if there is one, -ENOENT
+ * when the inputs are exhausted.
+ */
+int Next_input(Args *aa);
+
 /*
  * Convert args to a string
  */
@@ -0,0 +1,248 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * badmap.c - map of the ranges of a device that failed
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ *
+ * o  Any I/O thread can add a range; the threads finish ranges in
+ *    any order. Bad_sort() puts them in order and joins the
+ *    neighbours once they are all done.
+ *
+ * o  Read_rescue() is conv=noerror: when a read of a whole chunk
+ *    fails, read each half of what's left, and so on down to one
+ *    sector. Only the sectors that fail on their own are lost (and
+ *    zero filled); the rest of the chunk is read in a few large
+ *    reads - about two per halving.
+ */
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "utils/new.h"
+#include "fastdd.h"
+
+// Max ranges listed by Bad_print()
+#define BAD_LIST        32
+
+const char *Badnames[BAD_MAX] = {
+    "unreadable", "unwritable", "mismatch",
+};
+
+static int    cmprange(const void *a, const void *b);
+static size_t rescue(Badmap *m, int fd, uint8_t *buf, uint64_t off, size_t n, uint32_t lbs, int *eof);
+
+
+Badmap *
+Bad_new(void)
+{
+    Badmap *m = NEWZ(Badmap);
+
+    pthread_mutex_init(&m->lock, 0);
+    return m;
+}
+
+
+void
+Bad_free(Badmap *m)
+{
+    pthread_mutex_destroy(&m->lock);
+    DEL(m->v);
+    DEL(m);
+}
+
+
+/*
+ * Record 'len' bytes at 'off' as bad for reason 'kind' (BAD_xxx);
+ * 'err' is the errno, if any.
+ */
+void
+Bad_add(Badmap *m, int kind, uint64_t off, uint64_t len, int err)
+{
+    pthread_mutex_lock(&m->lock);
+
+    Badrange *p = m->n > 0 ? &m->v[m->n - 1] : 0;
+
+    m->bytes[kind] += len;
+    if (p && p->kind == kind && p->err == err && (p->off + p->len) == off) {
+        p->len += len;
+    } else {
+        if (m->n == m->cap) {
+            m->cap = m->cap ? 2 * m->cap : 64;
+            m->v   = RENEWA(Badrange, m->v, m->cap);
+            if (!m->v) error(1, ENOMEM, "can't grow the bad range map");
+        }
+
+        p = &m->v[m->n++];
+        p->off  = off;
+        p->len  = len;
+        p->kind = kind;
+        p->err  = err;
+    }
+
+    pthread_mutex_unlock(&m->lock);
+}
+
+
+/*
+ * Sort the ranges and join the adjacent ones of the same kind.
+ */
+void
+Bad_sort(Badmap *m)
+{
+    uint32_t i, j = 0;
+
+    if (m->n == 0) return;
+
+    qsort(m->v, m->n, sizeof m->v[0], cmprange);
+
+    for (i = 1; i < m->n; i++) {
+        Badrange *p = &m->v[j];
+        Badrange *q = &m->v[i];
+
+        if (q->kind == p->kind && q->err == p->err && (p->off + p->len) == q->off) {
+            p->len += q->len;
+        } else {
+            m->v[++j] = *q;
+        }
+    }
+    m->n = j + 1;
+}
+
+
+/*
+ * Print a summary and the first BAD_LIST ranges in sectors of 'lbs'
+ * bytes.
+ */
+void
+Bad_print(FILE *fp, const Badmap *m, uint64_t lbs)
+{
+    uint32_t i;
+    int k;
+
+    fprintf(fp, "bad: %u ranges;", m->n);
+    for (k = 0; k < BAD_MAX; k++)
+        fprintf(fp, "%s %" PRIu64 " sectors %s", k > 0 ? "," : "",
+                    (m->bytes[k] + lbs - 1) / lbs, Badnames[k]);
+    fputc('\n', fp);
+
+    for (i = 0; i < m->n && i < BAD_LIST; i++) {
+        const Badrange *p = &m->v[i];
+
+        fprintf(fp, "    lba %" PRIu64 "-%" PRIu64 ": %s", p->off / lbs,
+                    (p->off + p->len + lbs - 1) / lbs - 1, Badnames[p->kind]);
+        if (p->err != 0) fprintf(fp, " (%s)", strerror(p->err));
+        fputc('\n', fp);
+    }
+    if (m->n > BAD_LIST) fprintf(fp, "    .. and %u more\n", m->n - BAD_LIST);
+}
+
+
+/*
+ * Write the ranges to 'fn' as CSV in sectors of 'lbs' bytes. Return
+ * 0 on success, -errno on failure.
+ */
+int
+Bad_write(const Badmap *m, const char *fn, uint64_t lbs)
+{
+    FILE *fp = fopen(fn, "w");
+    uint32_t i;
+
+    if (!fp) return -errno;
+
+    fprintf(fp, "lba_start,lba_end,kind,error\n");
+    for (i = 0; i < m->n; i++) {
+        const Badrange *p = &m->v[i];
+
+        fprintf(fp, "%" PRIu64 ",%" PRIu64 ",%s,%s\n", p->off / lbs,
+                    (p->off + p->len + lbs - 1) / lbs - 1, Badnames[p->kind],
+                    p->err ? strerror(p->err) : "");
+    }
+
+    if (fclose(fp) != 0) return -errno;
+    return 0;
+}
+
+
+/*
+ * conv=noerror: read 'n' bytes at offset 'off' of 'fd' into 'buf'
+ * after a read of them failed. Sectors of 'lbs' bytes that can't be
+ * read are zero filled and added to 'm'. Return the bytes read;
+ * less than 'n' only at EOF.
+ */
+size_t
+Read_rescue(Badmap *m, int fd, uint8_t *buf, uint64_t off, size_t n, uint32_t lbs)
+{
+    int eof = 0;
+
+    return rescue(m, fd, buf, off, n, lbs ? lbs : 512, &eof);
+}
+
+
+static size_t
+rescue(Badmap *m, int fd, uint8_t *buf, uint64_t off, size_t n, uint32_t lbs, int *eof)
+{
+    size_t  k = 0;
+    ssize_t z;
+    int err = 0;
+
+    while (k < n) {
+        z = pread(fd, buf + k, n - k, off + k);
+        Sc_count(SC_IN, n - k, z);
+        if (z < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (z < 0) {
+            err = errno;
+            break;
+        }
+        if (z == 0) {
+            *eof = 1;
+            return k;
+        }
+        k += z;
+    }
+    if (err == 0) return n;
+
+    // What did come in is good; halve the rest.
+    buf += k;
+    off += k;
+    n   -= k;
+
+    if (n <= lbs) {
+        memset(buf, 0, n);
+        Bad_add(m, BAD_READ, off, n, err);
+        return k + n;
+    }
+
+    size_t h = (((n / 2) + lbs - 1) / lbs) * lbs;
+    size_t a = rescue(m, fd, buf, off, h, lbs, eof);
+
+    if (*eof) return k + a;
+    return k + h + rescue(m, fd, buf + h, off + h, n - h, lbs, eof);
+}
+
+
+static int
+cmprange(const void *a, const void *b)
+{
+    const Badrange *x = a;
+    const Badrange *y = b;
+
+    return x->off < y->off ? -1 : x->off > y->off;
+}
+
+/* EOF */
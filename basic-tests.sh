@@ -117,6 +117,178 @@ basictests() {
     xcmp $in $out
     rm -f $out
 
+    begin "concat inputs"
+    rdd if=/dev/urandom of=$in.3 bs=1024 count=3 || die "can't dd"
+    cat $in $in.3 > $in.4
+    fdd if=$in,$in.3 of=$out || die "failed concat"
+    xcmp $in.4 $out
+    rm -f $out
+
+    begin "concat inputs +skip +count"
+    rdd if=$in.4 of=$in.5 bs=1024 skip=7 count=3 || die "can't dd"
+    fdd if=$in,$in.3 of=$out bs=1024 skip=7 count=3 || die "failed concat skip"
+    xcmp $in.5 $out
+    rm -f $out
+
+    begin "rate limit"
+    fdd if=$in of=$out rate=32k burst=2k || die "failed rate"
+    cmp -s $in $out || die "failed rate compare"
+    rm -f $out
+    # a burst that isn't a multiple of the sector must not break O_DIRECT
+    if fdd if=$in of=$out iflag=direct; then
+        rm -f $out
+        fdd if=$in of=$out rate=64k burst=5000 iflag=direct engine=posix || die "failed rate + iflag=direct"
+        cmp -s $in $out || die "failed rate + iflag=direct compare"
+        end " OK"
+    else
+        end " OK (no O_DIRECT here; skipped iflag=direct)"
+    fi
+    rm -f $out
+
+    begin "status=json"
+    $FASTDD if=$in of=$out status=json 2>&1 | grep -q '"bytes_written": 8192' || die "failed status=json"
+    xcmp $in $out
+    rm -f $out
+
+    begin "histogram"
+    local h=$($FASTDD --histogram if=$in of=$out 2>&1)
+    echo "$h" | grep -q 'calls: p50' || die "failed histogram"
+    xcmp $in $out
+    rm -f $out
+
+    begin "status=perf"
+    local pf=$($FASTDD status=perf if=$in of=$out 2>&1)
+    echo "$pf" | grep -q 'page-faults/GiB' || die "failed status=perf"
+    xcmp $in $out
+    rm -f $out
+
+    begin "status=bottleneck"
+    local bn=$($FASTDD status=bottleneck if=$in of=$out 2>&1)
+    echo "$bn" | grep -q 'verdict: .*-bound' || die "failed status=bottleneck"
+    xcmp $in $out
+    rm -f $out
+
+    begin "status=syscalls"
+    local sc=$($FASTDD status=syscalls if=$in of=$out 2>&1)
+    echo "$sc" | grep -q 'syscalls: .*bytes/call' || die "failed status=syscalls"
+    xcmp $in $out
+    rm -f $out
+
+    begin "gen source"
+    fdd if=gen:random:7 of=$out bs=1024 count=300 || die "fail gen source"
+    fdd if=gen:random:7 bs=1024 count=300 > $out2 || die "fail gen source pipe"
+    [ $(filesz $out) -eq 307200 ] || die "gen source: wrong size"
+    cmp -s $out $out2 || die "gen source: pipe differs"
+    rm -f $out2
+    fdd if=gen:random:7 of=$out2 bs=1024 skip=5 count=295 || die "fail gen skip"
+    rdd if=$out of=$out.1 bs=1024 skip=5 || die "can't dd"
+    xcmp $out.1 $out2
+    rm -f $out.1
+    rm -f $out $out2
+
+    begin "null sink"
+    fdd if=$in of=null: || die "fail null sink"
+    [ -f null: ] && die "null sink created a file"
+    end " OK"
+
+    local e
+    for e in posix mmap cfr shard uring; do
+        begin "engine=$e +skip +seek"
+        if $FASTDD --explain engine=$e if=$in of=$out | grep -q '^engine: *none'; then
+            end " SKIP (unusable here)"
+            continue
+        fi
+        rdd if=$in of=$in.6 bs=1024 skip=3 || die "can't dd"
+        rdd if=$in.6 of=$out2 bs=1024 seek=2 || die "can't dd"
+        fdd if=$in of=$out engine=$e bs=1024 skip=3 seek=2 || die "fail engine=$e"
+        xcmp $out2 $out
+        rm -f $out $out2
+    done
+
+    begin "--explain"
+    $FASTDD --explain if=$in of=$out | grep -q '^engine: ' || die "fail explain"
+    [ -s $out ] && die "explain copied data"
+    end " OK"
+
+    begin "oflag=discard"
+    (cat $in; dd if=/dev/zero bs=1024 count=64 2>/dev/null; cat $in) > $in.7
+    rdd if=/dev/urandom of=$out bs=1024 count=100 || die "can't dd"
+    $FASTDD oflag=discard if=$in.7 of=$out status=json 2>&1 | grep -q '"bytes_elided": 65536' \
+        || die "fail discard elide"
+    rdd if=$in.7 of=$out2 bs=1024 count=80 || die "can't dd"
+    rdd if=$out of=$out2 bs=1024 skip=80 seek=80 conv=notrunc || die "can't dd"
+    cmp -s $out2 $out || die "fail discard copy"
+    # size unknown: only what is written over may be trimmed
+    rdd if=/dev/urandom of=$out bs=1024 count=400 || die "can't dd"
+    rdd if=$out of=$out2 bs=1024 || die "can't dd"
+    cat $in.7 | fdd oflag=discard of=$out bs=1024 seek=3 || die "fail discard pipe"
+    rdd if=$in.7 of=$out2 bs=1024 seek=3 conv=notrunc || die "can't dd"
+    cmp -s $out2 $out || die "fail discard pipe: trimmed past the copy"
+    end " OK"
+    rm -f $out $out2
+
+    begin "wipe"
+    cp $in $out; cp $in $out2
+    $FASTDD wipe of=$out bs=1024 seek=2 count=3 status=json 2>&1 | grep -q '"wiped": {"zero-range": 3072}\|"wiped": {"write": 3072}' \
+        || die "fail wipe zeros"
+    fdd wipe if=gen:pattern of=$out bs=1024 seek=8 count=8 || die "fail wipe pattern"
+    rdd if=/dev/zero of=$out2 bs=1024 seek=2 count=3 conv=notrunc || die "can't dd"
+    fdd if=gen:pattern of=$out2 bs=1024 seek=8 count=8 oflag=notrunc || die "can't gen"
+    cmp -s $out2 $out || die "fail wipe pattern compare"
+    # more than one write chunk: each must hold its own part of the stream
+    rm -f $out $out2
+    rdd if=/dev/zero of=$out bs=1048576 count=10 || die "can't dd"
+    fdd wipe if=gen:random:9 of=$out bs=1024 seek=1 count=9000 || die "fail wipe random"
+    rdd if=/dev/zero of=$out2 bs=1048576 count=10 || die "can't dd"
+    fdd if=gen:random:9 of=$out2 bs=1024 seek=1 count=9000 oflag=notrunc || die "can't gen"
+    cmp -s $out2 $out || die "fail wipe random compare"
+    end " OK"
+    rm -f $out $out2
+
+    begin "scan"
+    fdd scan if=$in bs=1024 skip=1 heatmap=$out || die "fail scan"
+    head -1 $out | grep -q '^lba_start,lba_end,reads,errors,mean_us,max_us,heat$' || die "fail heatmap header"
+    $FASTDD scan if=$in of=$out2 2>/dev/null && die "scan wrote to of="
+    end " OK"
+
+    begin "burnin"
+    rm -f $out
+    $FASTDD burnin of=$out bs=1024 count=300 status=json 2>&1 | grep -q '"ranges": 0, .*"mismatch_bytes": 0' \
+        || die "fail burnin"
+    [ $(filesz $out) -eq 307200 ] || die "fail burnin size"
+    # chunks that don't line up with the 4k blocks of the generator
+    $FASTDD burnin if=gen:entropy=50% of=$out bs=1024 count=300 iosize=10000 status=json 2>&1 \
+        | grep -q '"ranges": 0, .*"mismatch_bytes": 0' || die "fail burnin entropy=50% iosize=10000"
+    fdd burnin if=gen:zero of=$out && die "burnin accepted gen:zero"
+    rm -f $out
+    burnin_blk $t
+    case $? in
+        0) end " OK" ;;
+        2) end " OK (block device test skipped; needs root and a loop device)" ;;
+        *) die "fail burnin on a block device" ;;
+    esac
+
+    begin "noerror"
+    fdd conv=noerror,sync if=$in of=$out bs=1024 skip=3 badmap=$out2 || die "fail noerror"
+    [ "$(cat $out2)" = "lba_start,lba_end,kind,error" ] || die "fail badmap"
+    fdd conv=noerror engine=splice if=$in of=$out2 && die "splice accepted noerror"
+    fdd conv=sync if=$in of=$out2 && die "accepted sync without noerror"
+    rdd if=$in of=$out2 bs=1024 skip=3
+    cmp -s $out2 $out || die "fail noerror compare"
+    rm -f $out $out2
+    noerror_dm $t
+    case $? in
+        0) end " OK" ;;
+        2) end " OK (bad device test skipped; needs root and device-mapper)" ;;
+        *) die "fail noerror on a bad device" ;;
+    esac
+
+    begin "topology"
+    $(dirname $FASTDD)/disksize $in | grep -q 'rotational:' || die "fail disksize topology"
+    $FASTDD --explain engine=posix if=$in of=$out iosize=12k | grep -q '^iosize: *12288 ' \
+        || die "fail explicit iosize"
+    end " OK"
+
     begin "seek opipe"
     (fdd if=$in bs=1024 count=8 seek=1 | cat - >$out) && die "fail seek opipe"
     end " OK"
@@ -124,6 +296,68 @@ basictests() {
     rm -rf $TESTDIR
 }
 
+# conv=noerror over a device-mapper "error" target: sectors 64-71
+# of a 128 sector device fail. Needs root and device-mapper; returns
+# 2 if it can't run.
+noerror_dm() {
+    local t=$1
+    local dm=fastdd-test-$$
+    local lo e rc=0
+
+    [ $(id -u) -eq 0 ] || return 2
+    command -v dmsetup >/dev/null 2>&1 || return 2
+    command -v losetup >/dev/null 2>&1 || return 2
+
+    rdd if=/dev/urandom of=$t/dm.img bs=512 count=128 || return 1
+    lo=$(losetup -f --show $t/dm.img 2>/dev/null) || return 2
+    if ! printf "0 64 linear $lo 0\n64 8 error\n72 56 linear $lo 72\n" | dmsetup create $dm 2>/dev/null; then
+        losetup -d $lo
+        rm -f $t/dm.img
+        return 2
+    fi
+
+    for e in posix shard uring; do
+        $FASTDD --explain engine=$e if=/dev/mapper/$dm of=$t/dm.out | grep -q '^engine: *none' && continue
+        rm -f $t/dm.out $t/dm.bad
+        fdd conv=noerror engine=$e if=/dev/mapper/$dm of=$t/dm.out bs=512 badmap=$t/dm.bad
+        [ $? -eq 1 ] || { rc=1; break; }
+        grep -q '^64,71,unreadable,' $t/dm.bad || { rc=1; break; }
+        cp $t/dm.img $t/dm.ref
+        rdd if=/dev/zero of=$t/dm.ref bs=512 seek=64 count=8 conv=notrunc
+        cmp -s $t/dm.ref $t/dm.out || { rc=1; break; }
+    done
+
+    dmsetup remove $dm
+    losetup -d $lo
+    rm -f $t/dm.img $t/dm.out $t/dm.bad $t/dm.ref
+    return $rc
+}
+
+# burnin of a loop device: a sector aligned range verifies clean and
+# an unaligned one is refused rather than mapped as bad. Needs root;
+# returns 2 if it can't run.
+burnin_blk() {
+    local t=$1
+    local lo m r rc=0
+
+    [ $(id -u) -eq 0 ] || return 2
+    command -v losetup >/dev/null 2>&1 || return 2
+
+    rdd if=/dev/zero of=$t/lo.img bs=512 count=256 || return 1
+    lo=$(losetup -f --show $t/lo.img 2>/dev/null) || return 2
+
+    $FASTDD burnin of=$lo seek=8 count=64 bs=512 status=json 2>&1 \
+        | grep -q '"ranges": 0, .*"mismatch_bytes": 0' || rc=1
+    for r in "seek=1 count=64 bs=100" "count=1000 bs=1"; do
+        m=$($FASTDD burnin of=$lo $r 2>&1) && rc=1
+        echo "$m" | grep -q 'not sector aligned' || rc=1
+    done
+
+    losetup -d $lo
+    rm -f $t/lo.img
+    return $rc
+}
+
 begin() {
     echo -n "$@"
 }
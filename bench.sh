@@ -0,0 +1,384 @@
+#! /usr/bin/env bash
+
+# Repeatable benchmark for fastdd
+# Author: Sudhi Herle
+# License: Public Domain
+#
+# Runs a matrix of engine x iosize x source x sink x cache-state and
+# repeats each cell until the 95% confidence interval of the mean
+# throughput is within the target (or the max number of runs is
+# reached). Every cell is also run with the system dd(1) for
+# comparison. Results go to stdout (or -o FILE) as CSV or JSON;
+# progress goes to stderr.
+
+Z=$(basename $0)
+
+# Defaults; see usage()
+Size=256
+Iosizes="16k 64k 1M"
+Engines="-"
+Srcs="tmpfs disk fifo loop"
+Dsts="tmpfs disk fifo null"
+Caches="warm cold"
+Minruns=5
+Maxruns=20
+Target=5
+Format=csv
+Outfile=
+Diskdir=/var/tmp
+Tmpfsdir=/dev/shm
+Nodd=
+
+set -o pipefail
+
+die() {
+    echo "$Z: $@" 1>&2
+    exit 1
+}
+
+warn() {
+    echo "$Z: $@" 1>&2
+}
+
+usage() {
+    cat <<EOF
+$Z - repeatable benchmark for fastdd
+
+Usage: $Z [options]
+
+Options:
+  -s MB       Size of the test data in MB [$Size]
+  -i LIST     I/O sizes to try [$Iosizes]
+  -e LIST     Engines to try; '-' is the default engine [$Engines]
+  -S LIST     Sources: tmpfs disk fifo loop [$Srcs]
+  -D LIST     Sinks: tmpfs disk fifo null [$Dsts]
+  -c LIST     Cache states: warm cold [$Caches]
+  -n N        Min runs per cell [$Minruns]
+  -N N        Max runs per cell [$Maxruns]
+  -p PCT      Stop when the 95% CI is within PCT% of the mean [$Target]
+  -f FMT      Output format: csv json [$Format]
+  -o FILE     Write results to FILE [stdout]
+  -d DIR      Directory on disk for the 'disk' source/sink [$Diskdir]
+  -t DIR      Directory on tmpfs for the 'tmpfs' source/sink [$Tmpfsdir]
+  -G          Don't compare with dd(1)
+  -h          Show this help and exit
+
+'cold' drops the source from the page cache (POSIX_FADV_DONTNEED)
+before every run; it needs GNU dd. 'loop' needs root and losetup(8).
+EOF
+    exit 0
+}
+
+while getopts "s:i:e:S:D:c:n:N:p:f:o:d:t:Gh" o; do
+    case $o in
+        s) Size=$OPTARG ;;
+        i) Iosizes=$OPTARG ;;
+        e) Engines=$OPTARG ;;
+        S) Srcs=$OPTARG ;;
+        D) Dsts=$OPTARG ;;
+        c) Caches=$OPTARG ;;
+        n) Minruns=$OPTARG ;;
+        N) Maxruns=$OPTARG ;;
+        p) Target=$OPTARG ;;
+        f) Format=$OPTARG ;;
+        o) Outfile=$OPTARG ;;
+        d) Diskdir=$OPTARG ;;
+        t) Tmpfsdir=$OPTARG ;;
+        G) Nodd=1 ;;
+        h) usage ;;
+        *) die "Try '$Z -h'" ;;
+    esac
+done
+
+case $Format in
+    csv|json) ;;
+    *) die "unknown format $Format" ;;
+esac
+
+FASTDD=
+for d in rel dbg; do
+    f=$(uname)-$d/fastdd
+    if [ -x $f ]; then
+        FASTDD=$f
+        break
+    fi
+done
+
+[ -z $FASTDD ] && die "can't find fastdd in $(uname)-rel or $(uname)-dbg"
+
+# We need GNU dd to drop a file from the page cache
+Gnudd=
+dd --version 2>/dev/null | grep -q coreutils && Gnudd=1
+
+if [ -z "$Gnudd" ] && [[ $Caches == *cold* ]]; then
+    warn "no GNU dd; skipping cold cache runs"
+    Caches=${Caches/cold/}
+fi
+
+Tdir=$Tmpfsdir/fastdd-bench$$
+Ddir=$Diskdir/fastdd-bench$$
+Loopdev=
+Bgpid=
+
+mkdir -p $Tdir $Ddir || die "can't make bench dirs"
+
+cleanup() {
+    [ -n "$Bgpid" ] && kill $Bgpid 2>/dev/null
+    [ -n "$Loopdev" ] && losetup -d $Loopdev
+    rm -rf $Tdir $Ddir
+}
+trap cleanup EXIT INT QUIT TERM
+
+# wall clock in microseconds
+now() {
+    if [ -n "$EPOCHREALTIME" ]; then
+        local t=${EPOCHREALTIME/[.,]/}
+        echo $t
+    else
+        echo $(( $(date +%s%N) / 1000 ))
+    fi
+}
+
+# size string to bytes: 64k -> 65536
+tobytes() {
+    local s=$1
+    local n=${s%[kKmMgG]}
+    case $s in
+        *[kK]) echo $(( n * 1024 )) ;;
+        *[mM]) echo $(( n * 1024 * 1024 )) ;;
+        *[gG]) echo $(( n * 1024 * 1024 * 1024 )) ;;
+        *)     echo $n ;;
+    esac
+}
+
+# drop file or device 'f' from the page cache
+dropcache() {
+    local f=$1
+    dd if=$f iflag=nocache count=0 status=none 2>/dev/null
+}
+
+
+# -- Test data --
+
+Bytes=$(( Size * 1024 * 1024 ))
+
+warn "creating $Size MB of test data .."
+dd if=/dev/urandom of=$Tdir/src bs=1048576 count=$Size status=none 2>/dev/null || \
+    dd if=/dev/urandom of=$Tdir/src bs=1048576 count=$Size 2>/dev/null || die "can't make test data"
+cp $Tdir/src $Ddir/src || die "can't copy test data to $Ddir"
+sync
+
+if [[ $Srcs == *loop* ]]; then
+    if [ $(id -u) -eq 0 ] && type -p losetup >/dev/null; then
+        Loopdev=$(losetup -f --show $Ddir/src 2>/dev/null)
+    fi
+    if [ -z "$Loopdev" ]; then
+        warn "can't setup a loop device; skipping 'loop' source"
+        Srcs=${Srcs/loop/}
+    fi
+fi
+
+# Source 'src' as a path for the tool; fifo sources get a producer.
+srcpath() {
+    case $1 in
+        tmpfs) echo $Tdir/src ;;
+        disk)  echo $Ddir/src ;;
+        loop)  echo $Loopdev ;;
+        fifo)  echo $Tdir/ififo ;;
+    esac
+}
+
+dstpath() {
+    case $1 in
+        tmpfs) echo $Tdir/dst ;;
+        disk)  echo $Ddir/dst ;;
+        null)  echo /dev/null ;;
+        fifo)  echo $Tdir/ofifo ;;
+    esac
+}
+
+# Get ready for one run: drop caches, clear old output and start the
+# process at the other end of a fifo.
+prepare() {
+    local src=$1
+    local dst=$2
+    local cache=$3
+
+    rm -f $Tdir/dst $Ddir/dst $Tdir/ififo $Tdir/ofifo
+
+    if [ $cache = cold ]; then
+        case $src in
+            fifo) dropcache $Tdir/src ;;
+            *)    dropcache $(srcpath $src) ;;
+        esac
+    fi
+
+    Bgpid=
+    if [ $src = fifo ]; then
+        mkfifo $Tdir/ififo || die "can't make fifo"
+        cat $Tdir/src > $Tdir/ififo &
+        Bgpid=$!
+    elif [ $dst = fifo ]; then
+        mkfifo $Tdir/ofifo || die "can't make fifo"
+        cat $Tdir/ofifo > /dev/null &
+        Bgpid=$!
+    fi
+}
+
+# Run one copy and print its throughput in MB/s.
+runone() {
+    local tool=$1
+    local engine=$2
+    local src=$(srcpath $3)
+    local dst=$(dstpath $4)
+    local ios=$5
+
+    local eng=
+    [ "$engine" != "-" ] && eng="engine=$engine"
+
+    local t0=$(now)
+    case $tool in
+        fastdd) $FASTDD -q if=$src of=$dst iosize=$ios $eng 2>/dev/null ;;
+        dd)     dd if=$src of=$dst bs=$ios 2>/dev/null ;;
+    esac
+    local r=$?
+    local t1=$(now)
+
+    [ -n "$Bgpid" ] && wait $Bgpid
+    Bgpid=
+
+    [ $r -ne 0 ] && return 1
+    awk -v b=$Bytes -v us=$(( t1 - t0 )) 'BEGIN { printf "%.2f\n", b / us }'
+}
+
+# Mean, 95% CI half-width, min and max of the numbers on stdin.
+stats() {
+    awk '
+    BEGIN {
+        # two sided 95% Student t for n-1 degrees of freedom
+        split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 " \
+              "2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 2.093 2.086 "  \
+              "2.080 2.074 2.069 2.064 2.060 2.056 2.052 2.048 2.045 2.042", T, " ")
+    }
+    {
+        x[n++] = $1; s += $1
+        if (n == 1 || $1 < lo) lo = $1
+        if (n == 1 || $1 > hi) hi = $1
+    }
+    END {
+        m = s / n
+        for (i = 0; i < n; i++) v += (x[i] - m) ^ 2
+        ci = 0
+        if (n > 1) {
+            t  = (n - 1) <= 30 ? T[n - 1] : 1.96
+            ci = t * sqrt(v / (n - 1)) / sqrt(n)
+        }
+        printf "%.2f %.2f %.2f %.2f\n", m, ci, lo, hi
+    }'
+}
+
+# Run a cell until its CI is tight enough; print "n mean ci min max".
+runcell() {
+    local tool=$1 engine=$2 src=$3 dst=$4 ios=$5 cache=$6
+    local runs=$Tdir/runs
+    local n=0
+    local st
+
+    : > $runs
+    while [ $n -lt $Maxruns ]; do
+        prepare $src $dst $cache
+        runone $tool $engine $src $dst $ios >> $runs || return 1
+        n=$(( n + 1 ))
+
+        [ $n -lt $Minruns ] && continue
+
+        st=$(stats < $runs)
+        set -- $st
+        awk -v m=$1 -v ci=$2 -v p=$Target 'BEGIN { exit !(m > 0 && 100 * ci / m <= p) }' && break
+    done
+
+    echo "$n $(stats < $runs)"
+}
+
+
+# -- Output --
+
+Nrows=0
+
+header() {
+    case $Format in
+        csv)  echo "tool,engine,src,dst,iosize,cache,runs,mean_mbs,ci95_mbs,min_mbs,max_mbs,vs_dd" ;;
+        json) echo "[" ;;
+    esac
+}
+
+row() {
+    local tool=$1 engine=$2 src=$3 dst=$4 ios=$5 cache=$6
+    local n=$7 mean=$8 ci=$9 lo=${10} hi=${11} vs=${12}
+
+    case $Format in
+        csv)  echo "$tool,$engine,$src,$dst,$ios,$cache,$n,$mean,$ci,$lo,$hi,$vs" ;;
+        json)
+            [ $Nrows -gt 0 ] && echo ","
+            [ -z "$vs" ] && vs=null
+            echo -n "  {\"tool\": \"$tool\", \"engine\": \"$engine\", \"src\": \"$src\", \"dst\": \"$dst\""
+            echo -n ", \"iosize\": $ios, \"cache\": \"$cache\", \"runs\": $n, \"mean_mbs\": $mean"
+            echo -n ", \"ci95_mbs\": $ci, \"min_mbs\": $lo, \"max_mbs\": $hi, \"vs_dd\": $vs}"
+            ;;
+    esac
+    Nrows=$(( Nrows + 1 ))
+}
+
+footer() {
+    [ $Format = json ] && printf "\n]\n"
+}
+
+
+bench() {
+    local src dst ios cache eng r ddmean vs
+
+    header
+    for src in $Srcs; do
+    for dst in $Dsts; do
+        # fifo to fifo needs two helpers; it tells us nothing new
+        [ $src = fifo ] && [ $dst = fifo ] && continue
+
+        for ios in $Iosizes; do
+        ios=$(tobytes $ios)
+        for cache in $Caches; do
+            ddmean=
+            if [ -z "$Nodd" ]; then
+                warn "dd: $src -> $dst iosize=$ios $cache"
+                if r=$(runcell dd - $src $dst $ios $cache); then
+                    set -- $r
+                    ddmean=$2
+                    row dd - $src $dst $ios $cache $r ""
+                else
+                    warn "dd failed"
+                fi
+            fi
+
+            for eng in $Engines; do
+                warn "fastdd $eng: $src -> $dst iosize=$ios $cache"
+                if ! r=$(runcell fastdd $eng $src $dst $ios $cache); then
+                    warn "fastdd failed"
+                    continue
+                fi
+
+                set -- $r
+                vs=
+                [ -n "$ddmean" ] && vs=$(awk -v a=$2 -v b=$ddmean 'BEGIN { if (b > 0) printf "%.2f", a / b }')
+                row fastdd $eng $src $dst $ios $cache $r "$vs"
+            done
+        done
+        done
+    done
+    done
+    footer
+}
+
+if [ -n "$Outfile" ]; then
+    bench > $Outfile
+else
+    bench
+fi
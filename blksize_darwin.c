@@ -17,9 +17,13 @@
 #include <inttypes.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <sys/disk.h>
+#include "utils/utils.h"
 #include "fastdd.h"
 
 
@@ -40,3 +44,37 @@ Blksize(uint64_t *p_size, int fd)
     *p_size = nblks * bsiz;
     return 0;
 }
+
+
+/*
+ * Fill 'd' with what the disk ioctls tell us about block device
+ * 'fd'. Darwin has no notion of queue depth or rotational here.
+ */
+int
+Devinfo_get(Devinfo *d, int fd)
+{
+    struct stat st;
+    uint32_t bsiz  = 0,
+             pbsiz = 0;
+    uint64_t nblks = 0,
+             maxio = 0;
+
+    memset(d, 0, sizeof *d);
+    d->rotational = -1;
+
+    if (fstat(fd, &st) < 0) return -errno;
+    if (!S_ISBLK(st.st_mode)) return 0;
+
+    if (ioctl(fd, DKIOCGETBLOCKSIZE,  &bsiz)  != 0) return -errno;
+    if (ioctl(fd, DKIOCGETBLOCKCOUNT, &nblks) != 0) return -errno;
+
+    d->size = nblks * bsiz;
+    d->lbs  = d->pbs = bsiz;
+
+    if (ioctl(fd, DKIOCGETPHYSICALBLOCKSIZE, &pbsiz) == 0) d->pbs   = pbsiz;
+    if (ioctl(fd, DKIOCGETMAXBYTECOUNTREAD,  &maxio) == 0) d->maxio = maxio;
+
+    d->iomin = d->pbs;
+    strcopy(d->name, sizeof d->name, devname(st.st_rdev, S_IFBLK));
+    return 0;
+}
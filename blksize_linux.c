@@ -1,6 +1,7 @@
 /* vim: expandtab:tw=68:ts=4:sw=4:
  *
- * blksize_linux.c - Fetch blocksize for a given block device
+ * blksize_linux.c - Fetch blocksize and topology for a given block
+ *                   device
  *
  * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
  *
@@ -15,12 +16,22 @@
  *
  */
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <inttypes.h>
 #include <sys/ioctl.h>
 #include <linux/fs.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "utils/utils.h"
 #include "fastdd.h"
 
+static int rotational(const char *disk, int depth);
+
 /*
  * Fetch blocksize in bytes for block device 'fd'.
  * Return 0 on success, -errno on failure.
@@ -35,3 +46,144 @@ Blksize(uint64_t *p_size, int fd)
     *p_size = oct;
     return 0;
 }
+
+
+/*
+ * Read an unsigned integer from 'dir/file' in sysfs.
+ * Return 0 on success, -errno on failure.
+ */
+static int
+sysfs_u64(uint64_t *v, const char *dir, const char *file)
+{
+    char fn[PATH_MAX];
+    char buf[64];
+
+    snprintf(fn, sizeof fn, "%s/%s", dir, file);
+
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0) return -errno;
+
+    ssize_t n = read(fd, buf, sizeof buf - 1);
+    close(fd);
+    if (n <= 0) return n < 0 ? -errno : -EINVAL;
+
+    buf[n] = 0;
+    *v = strtoull(buf, 0, 10);
+    return 0;
+}
+
+
+/*
+ * Fill 'd' with the block device topology of 'fd'. For anything
+ * other than a block device, we describe the device the file lives
+ * on (sysfs only).
+ *
+ * Sector sizes and I/O hints come from the BLK* ioctls when we have
+ * a block device; the queue limits always come from
+ * /sys/dev/block/MAJ:MIN/queue (a partition's queue is its disk's).
+ */
+int
+Devinfo_get(Devinfo *d, int fd)
+{
+    struct stat st;
+    char dir[PATH_MAX];
+    char rp[PATH_MAX];
+    uint64_t v;
+    dev_t dev;
+
+    memset(d, 0, sizeof *d);
+    d->rotational = -1;
+
+    if (fstat(fd, &st) < 0) return -errno;
+
+    if (S_ISBLK(st.st_mode)) {
+        int lbs = 0;
+        unsigned int pbs = 0, iomin = 0, ioopt = 0, dz = 0;
+
+        if (ioctl(fd, BLKGETSIZE64, &d->size) != 0) return -errno;
+        if (ioctl(fd, BLKSSZGET,  &lbs)   == 0) d->lbs   = lbs;
+        if (ioctl(fd, BLKPBSZGET, &pbs)   == 0) d->pbs   = pbs;
+        if (ioctl(fd, BLKIOMIN,   &iomin) == 0) d->iomin = iomin;
+        if (ioctl(fd, BLKIOOPT,   &ioopt) == 0) d->ioopt = ioopt;
+        if (ioctl(fd, BLKDISCARDZEROES, &dz) == 0) d->dzeroes = dz != 0;
+        dev = st.st_rdev;
+    } else if (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)) {
+        dev = st.st_dev;
+    } else {
+        return 0;
+    }
+
+    snprintf(dir, sizeof dir, "/sys/dev/block/%u:%u", major(dev), minor(dev));
+    if (!realpath(dir, rp)) return 0;   // not a real block device (tmpfs etc.)
+
+    const char *nm = strrchr(rp, '/');
+    strcopy(d->name, sizeof d->name, nm ? nm+1 : rp);
+
+    if (sysfs_u64(&v, rp, "partition") == 0) {
+        // The queue belongs to the whole disk
+        char *p = strrchr(rp, '/');
+        if (p) *p = 0;
+    }
+
+    strcopy(dir, sizeof dir, rp);
+    strcat(dir, "/queue");
+
+    if (!d->lbs   && sysfs_u64(&v, dir, "logical_block_size")  == 0) d->lbs   = v;
+    if (!d->pbs   && sysfs_u64(&v, dir, "physical_block_size") == 0) d->pbs   = v;
+    if (!d->iomin && sysfs_u64(&v, dir, "minimum_io_size")     == 0) d->iomin = v;
+    if (!d->ioopt && sysfs_u64(&v, dir, "optimal_io_size")     == 0) d->ioopt = v;
+
+    if (sysfs_u64(&v, dir, "max_sectors_kb")      == 0) d->maxio       = v * 1024;
+    if (sysfs_u64(&v, dir, "discard_granularity") == 0) d->discard     = v;
+    if (sysfs_u64(&v, dir, "nr_requests")         == 0) d->nr_requests = v;
+    if (sysfs_u64(&v, dir, "write_zeroes_max_bytes") == 0) d->wzmax    = v;
+
+    d->rotational = rotational(rp, 0);
+    return 0;
+}
+
+
+/*
+ * Return 1 if the disk in sysfs dir 'disk' spins, 0 if it doesn't
+ * and -1 if we can't tell.
+ *
+ * dm and md devices claim to be solid state no matter what they
+ * sit on; so a stacked device is as rotational as its slaves - it
+ * spins if any of them does.
+ */
+static int
+rotational(const char *disk, int depth)
+{
+    char dir[PATH_MAX+2*NAME_MAX];
+    char rp[PATH_MAX];
+    struct dirent *de;
+    uint64_t v;
+    int r = -1;
+    DIR *dp;
+
+    snprintf(dir, sizeof dir, "%s/slaves", disk);
+    if (depth < 8 && (dp = opendir(dir))) {
+        while ((de = readdir(dp))) {
+            if (de->d_name[0] == '.') continue;
+
+            snprintf(dir, sizeof dir, "%s/slaves/%s", disk, de->d_name);
+            if (!realpath(dir, rp)) continue;
+
+            // A slave may be a partition; the queue is its disk's.
+            if (sysfs_u64(&v, rp, "partition") == 0) {
+                char *p = strrchr(rp, '/');
+                if (p) *p = 0;
+            }
+
+            int x = rotational(rp, depth+1);
+            if (x > r) r = x;
+            if (r == 1) break;
+        }
+        closedir(dp);
+        if (r >= 0) return r;
+    }
+
+    snprintf(dir, sizeof dir, "%s/queue", disk);
+    if (sysfs_u64(&v, dir, "rotational") == 0) return !!v;
+    return -1;
+}
@@ -17,7 +17,10 @@
 #include <inttypes.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <sys/disklabel.h>
 #include <sys/dkio.h>
@@ -50,3 +53,29 @@ Blksize(uint64_t *p_size, int fd)
     *p_size = sz * dl.d_secsize;
     return 0;
 }
+
+
+/*
+ * Fill 'd' with what the disklabel tells us about block device
+ * 'fd'; that's only the sector size.
+ */
+int
+Devinfo_get(Devinfo *d, int fd)
+{
+    struct disklabel dl;
+    struct stat st;
+    uint64_t sz;
+
+    memset(d, 0, sizeof *d);
+    d->rotational = -1;
+
+    if (fstat(fd, &st) < 0) return -errno;
+    if (!S_ISBLK(st.st_mode)) return 0;
+
+    if (ioctl(fd, DIOCGPDINFO, &dl) != 0) return -errno;
+    if (Blksize(&sz, fd) == 0) d->size = sz;
+
+    d->lbs = d->pbs = d->iomin = dl.d_secsize;
+    strcopy(d->name, sizeof d->name, devname(st.st_rdev, S_IFBLK));
+    return 0;
+}
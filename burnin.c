@@ -0,0 +1,294 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * burnin.c - the burnin mode: write a pattern over the output, read
+ *            it back and compare.
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ *
+ * o  Two passes over the range, each by several threads that claim
+ *    the next iosize chunk: the first writes, the second reads back
+ *    and verifies. A thread verifies its chunk while the others
+ *    read theirs; so the read pass has at least two threads.
+ *
+ * o  Every chunk is generated after Gen_seek() to its offset in the
+ *    range. The verifier seeks the same way and regenerates the
+ *    pattern GEN_BLK bytes at a time into a buffer that stays in L1;
+ *    the pattern itself is never stored. A byte of the pattern
+ *    depends only on its offset, so the chunks and GEN_BLK needn't
+ *    line up. Gen_fill() is written to vectorize and memcmp() is
+ *    vectorized by libc.
+ *
+ * o  Block devices are written and read with O_DIRECT (see args.c).
+ *    Files go through the page cache; we sync and drop their pages
+ *    between the passes so that the read pass goes to the disk.
+ *
+ * o  Failures don't stop a pass; every failed range goes to g->bad
+ *    by sector.
+ */
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "error.h"
+#include "utils/new.h"
+#include "fastdd.h"
+#include "probes.h"
+
+// Max I/O threads
+#define BURNIN_THREADS  32
+
+#define PASS_WRITE      0
+#define PASS_VERIFY     1
+
+struct burnin
+{
+    Args   *args;
+    Acctg  *acc;
+    Badmap *bad;
+
+    int      pass;      // PASS_xxx
+    int      nthr;
+    uint64_t next;      // offset (in the range) of the next unclaimed chunk
+    uint64_t len;
+    uint64_t io;
+    uint32_t lbs;       // sector size; granularity of a mismatch
+
+    pthread_mutex_t lock;   // serializes the fold into 'acc'
+};
+typedef struct burnin burnin;
+
+static void  run_pass(burnin *b, int pass);
+static void *burnin_thread(void *v);
+static void  verify(burnin *b, const uint8_t *buf, size_t n, uint64_t rel);
+static int   nthreads(Args *a, int pass);
+
+
+int
+Burnin(Acctg *g, Args *a)
+{
+    burnin b = {
+        .args = a,
+        .acc  = g,
+        .bad  = g->bad,
+        .len  = a->insize,
+        .io   = a->iosize,
+        .lbs  = a->odev.lbs ? a->odev.lbs : 512,
+    };
+
+    if (b.lbs > GEN_BLK) b.lbs = GEN_BLK;
+
+    Trace_thread("burnin");
+
+    g->engine = "burnin";
+    g->iosize = b.io;
+
+    pthread_mutex_init(&b.lock, 0);
+
+    run_pass(&b, PASS_WRITE);
+
+    // What we read back must come from the device.
+    if (fdatasync(a->ofd) < 0) error(0, errno, "%s: can't sync", a->outfile);
+#ifdef POSIX_FADV_DONTNEED
+    if (a->align == 0) posix_fadvise(a->ofd, a->seek, a->insize, POSIX_FADV_DONTNEED);
+#endif
+
+    run_pass(&b, PASS_VERIFY);
+
+    pthread_mutex_destroy(&b.lock);
+
+    Bad_sort(g->bad);
+    return g->bad->n > 0 ? -EIO : 0;
+}
+
+
+void
+Burnin_explain(FILE *fp, Args *a)
+{
+    fprintf(fp, "mode:      burnin\n");
+    fprintf(fp, "range:     %" PRIu64 " bytes at offset %" PRIu64 "\n", a->insize, a->seek);
+    fprintf(fp, "pattern:   %s, seed %#" PRIx64 "\n", a->gen.type == GEN_PATTERN ? "pattern" : "random",
+                a->gen.seed);
+    fprintf(fp, "iosize:    %" PRIu64 " bytes\n", a->iosize);
+    fprintf(fp, "threads:   %d write, %d verify\n", nthreads(a, PASS_WRITE), nthreads(a, PASS_VERIFY));
+
+    if (a->align > 0) fprintf(fp, "alignment: %u bytes (O_DIRECT)\n", a->align);
+    else              fprintf(fp, "alignment: none (buffered I/O; page cache dropped before verify)\n");
+}
+
+
+static void
+run_pass(burnin *b, int pass)
+{
+    int i, n = nthreads(b->args, pass);
+    pthread_t *id = NEWZA(pthread_t, n);
+
+    b->pass = pass;
+    b->next = 0;
+    b->nthr = n;
+
+    b->acc->qsize  = n;
+    b->acc->bufmem = n * b->io;
+
+    for (i = 0; i < n; i++) {
+        int r = pthread_create(&id[i], 0, burnin_thread, b);
+        if (r != 0) error(1, r, "can't create burnin thread %d", i);
+    }
+
+    for (i = 0; i < n; i++) pthread_join(id[i], 0);
+
+    DEL(id);
+}
+
+
+static void *
+burnin_thread(void *v)
+{
+    burnin *b  = v;
+    Args   *a  = b->args;
+    Acctg  *g  = b->acc;
+    size_t  pg = sysconf(_SC_PAGESIZE);
+    void   *buf = 0;
+    Ratelimit rl;
+    Acctg  l;       // this thread's latencies
+
+    memset(&l, 0, sizeof l);
+    l.timing  = g->timing;
+    l.tracing = g->tracing;
+
+    Ratelimit_init(&rl, a->rate / b->nthr, a->burst / b->nthr);
+
+    Trace_thread(b->pass == PASS_WRITE ? "burnin-write" : "burnin-verify");
+
+    int r = posix_memalign(&buf, a->align > pg ? a->align : pg, b->io);
+    if (r != 0) error(1, r, "can't allocate burnin buffer");
+
+    while (1) {
+        uint64_t rel = __atomic_fetch_add(&b->next, b->io, __ATOMIC_RELAXED);
+        if (rel >= b->len) break;
+
+        uint64_t off = a->seek + rel;
+        size_t   m   = b->len - rel < b->io ? b->len - rel : b->io;
+        uint8_t *p   = buf;
+        size_t   k;
+        ssize_t  z;
+        int err = 0;
+
+        if (b->pass == PASS_WRITE) {
+            Gen gg = a->gen;
+
+            Gen_seek(&gg, rel);
+            Gen_fill(&gg, p, m);
+
+            PROBE2(write__start, a->ofd, m);
+            for (k = 0; k < m; ) {
+                TIMED(&l, LAT_WR, z = pwrite(a->ofd, p + k, m - k, off + k));
+                Sc_count(SC_OUT, m - k, z);
+                if (z < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+                if (z <= 0) {
+                    err = z < 0 ? errno : EIO;
+                    break;
+                }
+                k += z;
+            }
+            PROBE2(chunk__write, a->ofd, k);
+
+            __atomic_fetch_add(&g->nwr, k, __ATOMIC_RELAXED);
+            if (err != 0) Bad_add(b->bad, BAD_WRITE, off + k, m - k, err);
+        } else {
+            PROBE2(read__start, a->ofd, m);
+            for (k = 0; k < m; ) {
+                TIMED(&l, LAT_RD, z = pread(a->ofd, p + k, m - k, off + k));
+                Sc_count(SC_IN, m - k, z);
+                if (z < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+                if (z <= 0) {
+                    err = z < 0 ? errno : EIO;
+                    break;
+                }
+                k += z;
+            }
+            PROBE2(chunk__read, a->ofd, k);
+
+            __atomic_fetch_add(&g->nrd, k, __ATOMIC_RELAXED);
+            if (err != 0) Bad_add(b->bad, BAD_READ, off + k, m - k, err);
+
+            verify(b, p, k, rel);
+        }
+
+        if (err != 0) __atomic_fetch_add(&g->nerrors, 1, __ATOMIC_RELAXED);
+        Ratelimit(&rl, m);
+    }
+
+    free(buf);
+
+    pthread_mutex_lock(&b->lock);
+    for (r = 0; r < LAT_MAX; r++) Hist_merge(&g->lat[r], &l.lat[r]);
+    for (r = 0; r < EV_MAX; r++)  Acct_add(&g->busy_ns[r], l.busy_ns[r]);
+    pthread_mutex_unlock(&b->lock);
+
+    Acct_fold(g);
+    return 0;
+}
+
+
+/*
+ * Compare the 'n' bytes at 'buf' with the pattern at offset 'rel'
+ * of the range; add the sectors that differ to the bad map.
+ */
+static void
+verify(burnin *b, const uint8_t *buf, size_t n, uint64_t rel)
+{
+    uint8_t want[GEN_BLK] __attribute__((aligned(64)));
+    uint64_t off = b->args->seek + rel;
+    Gen gg = b->args->gen;
+    size_t k, s;
+
+    Gen_seek(&gg, rel);
+
+    for (k = 0; k < n; k += GEN_BLK) {
+        size_t m = n - k < GEN_BLK ? n - k : GEN_BLK;
+
+        Gen_fill(&gg, want, m);
+        if (0 == memcmp(want, buf + k, m)) continue;
+
+        for (s = 0; s < m; s += b->lbs) {
+            size_t q = m - s < b->lbs ? m - s : b->lbs;
+
+            if (memcmp(want + s, buf + k + s, q))
+                Bad_add(b->bad, BAD_DATA, off + k + s, q, 0);
+        }
+    }
+}
+
+
+/*
+ * As many requests in flight as the device queue takes, except on a
+ * spinning disk. The verify pass needs a second thread to read while
+ * one compares.
+ */
+static int
+nthreads(Args *a, int pass)
+{
+    int n = a->qdepth < BURNIN_THREADS ? a->qdepth : BURNIN_THREADS;
+
+    if (a->rotational == 1 || n < 1) n = 1;
+    if (pass == PASS_VERIFY && n < 2) n = 2;
+    return n;
+}
+
+/* EOF */
@@ -0,0 +1,133 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * copy_cfr.c - copy_file_range(2) engine for linux
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ *
+ * o  The kernel moves the data without a trip through a pipe or
+ *    userspace; on filesystems that support it (xfs, btrfs, nfs)
+ *    this is a reflink or a server side copy.
+ *
+ * o  Both fds are used with their own file offsets (set up by the
+ *    skip/seek below); so the multi-input case just works.
+ *
+ * o  Kernels and filesystems that can't do it fail the very first
+ *    call; we then hand over to the splice engine.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "fastdd.h"
+#include "probes.h"
+
+// Chunk size when we're free to choose
+#define CFR_CHUNK       (8 * 1048576)
+
+
+/*
+ * Return the size of each copy_file_range() call for 'a'. The
+ * kernel does the I/O; so bigger is cheaper - unless we are rate
+ * limiting.
+ */
+uint64_t
+Cfr_iosize(Args *a)
+{
+    if (a->rate > 0 || a->iosize >= CFR_CHUNK) return a->iosize;
+    return CFR_CHUNK;
+}
+
+
+int
+Copy_cfr(Acctg *g, Args *a)
+{
+    uint64_t io = Cfr_iosize(a);
+    uint64_t n  = a->insize;
+    int first   = 1;
+    Ratelimit rl;
+
+    Ratelimit_init(&rl, a->rate, a->burst);
+
+    Trace_thread("cfr");
+
+    g->engine = "cfr";
+    g->iosize = io;
+    g->bufmem = 0;
+
+    if (a->skip > 0) {
+        int r = skip_input(a, a->skip);
+        if (r < 0) error(1, -r, "can't skip %" PRIu64 " bytes from %s", a->skip, a->infile);
+    }
+
+    if (a->seek > 0) {
+        Sc.calls[SC_SEEK]++;
+        if (lseek(a->ofd, a->seek, SEEK_SET) < 0)
+            error(1, errno, "%s: can't seek %" PRIu64 " bytes", a->outfile, a->seek);
+    }
+
+    while (1) {
+        size_t  m = n > 0 && n <= io ? n : io;
+        ssize_t r;
+
+        PROBE2(splice__start, a->ifd, m);
+        TIMED(g, LAT_SPLICE, r = copy_file_range(a->ifd, 0, a->ofd, 0, m, 0));
+        PROBE2(splice__done, a->ifd, r);
+        Sc_count(SC_SPLICE, m, r);
+        if (r < 0) {
+            int err = errno;
+
+            if (err == EINTR || err == EAGAIN) continue;
+
+            // Nothing has moved yet and the input is already past
+            // skip=; the splice engine writes at seek= on its own.
+            if (first && (err == EXDEV || err == EINVAL || err == ENOSYS ||
+                          err == EOPNOTSUPP || err == EBADF)) {
+                uint64_t sk = a->skip;
+
+                Verbose("copy_file_range: %s; falling back to splice\n", strerror(err));
+                Acct_fold(g);
+                a->skip = 0;
+                r = Copy_splice(g, a);
+                a->skip = sk;
+                return r;
+            }
+
+            Reporter_stop(0);
+            error(1, err, "I/O error in copy_file_range around offset %" PRIu64 "", g->nrd);
+        }
+
+        first = 0;
+        if (r == 0) {
+            // EOF on this input; move on to the next one.
+            if (Next_input(a) == 0) continue;
+            break;
+        }
+
+        Acct_add(&g->nrd, r);
+        Acct_add(&g->nwr, r);
+        Ratelimit(&rl, r);
+
+        if (n > 0) {
+            n -= r;
+            if (n == 0) break;
+        }
+    }
+
+    Acct_fold(g);
+    return 0;
+}
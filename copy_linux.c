@@ -1,6 +1,6 @@
 /* vim: expandtab:tw=68:ts=4:sw=4:
  *
- * copy_linux.c - fast path for linux using copy_file_range()
+ * copy_linux.c - splice(2) engine for linux
  *
  * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
  *
@@ -13,29 +13,40 @@
  * warranty; it is provided "as is". No claim  is made to its
  * suitability for any purpose.
  */
+#include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
 
 #include "error.h"
 #include "utils/new.h"
-#include "utils/progbar.h"
 #include "fast/syncq.h"
 #include "fastdd.h"
+#include "probes.h"
 
 //static int pipe_splice_threaded(Acctg *g, Args *a);
 static int pipe_splice_sequential(Acctg *g, Args *a);
-
-#define progressbar_err(p)  progressbar_finish(p, 0, 1)
+static int gen_splice(Acctg *g, Args *a);
+static int allpipes(Args *a);
+static uint64_t pipesize(int fd);
+static void pipe_wait(Acctg *g, Args *a);
+static int pipe_full(int fd);
 
 int
-Copy(Acctg *g, Args *a)
+Copy_splice(Acctg *g, Args *a)
 {
     /*
      * If neither source or dest is a pipe, we have to create a pipe
-     * and connect the two.
+     * and connect the two. When there are several inputs, every
+     * one of them must be a pipe. An input pipe into an aligned
+     * output also goes through our pipe: a direct splice writes
+     * whatever the pipe has, and a short write misaligns all the
+     * ones after it.
      */
-    if (!(a->ipipe || a->opipe)) return pipe_splice_sequential(g, a);
+    if (a->gen.type != GEN_NONE) return gen_splice(g, a);
+    if (!a->opipe && (!allpipes(a) || a->oalign > 0)) return pipe_splice_sequential(g, a);
 
 
     /*
@@ -43,28 +54,28 @@ Copy(Acctg *g, Args *a)
      * call is sufficient.
      */
 
-    off_t ioff  = a->skip,
-          ooff  = a->seek;
+    off_t ooff  = a->seek;
     uint64_t n  = a->insize;
     int done    = 0;
 
-    loff_t *p_in  = 0,
-           *p_out = 0;
+    loff_t *p_out = 0;
+
+    Ratelimit rl;
 
-    progress p;
+    Ratelimit_init(&rl, a->rate, a->burst);
 
-    progressbar_init(&p, Quiet ? -1 : 2, a->insize, P_HUMAN);
+    Trace_thread("splice");
+
+    g->engine = "splice";
+    g->iosize = a->iosize;
+    g->bufmem = pipesize(a->opipe ? a->ofd : a->ifd);
 
     /*
      * Skip initial bytes on the input & output as needed.
      */
-    if (ioff > 0) {
-        if (a->ipipe) {
-            ssize_t r = skip(a->ifd, ioff);
-            if (r < 0) error(1, -r, "can't skip %" PRIu64 " bytes from %s", ioff, a->infile);
-        } else {
-            p_in = &ioff;
-        }
+    if (a->skip > 0) {
+        int r = skip_input(a, a->skip);
+        if (r < 0) error(1, -r, "can't skip %" PRIu64 " bytes from %s", a->skip, a->infile);
     }
 
     if (ooff > 0) {
@@ -76,26 +87,41 @@ Copy(Acctg *g, Args *a)
 
     while (!done) {
         size_t  m = n > 0 && n <= a->iosize ? n : a->iosize;
-        ssize_t r = splice(a->ifd, p_in, a->ofd, p_out, m, SPLICE_F_MOVE|SPLICE_F_MORE);
+        ssize_t r;
+
+        if (g->pipewait) pipe_wait(g, a);
+
+        PROBE2(splice__start, a->ifd, m);
+        TIMED(g, LAT_SPLICE, r = splice(a->ifd, 0, a->ofd, p_out, m, SPLICE_F_MOVE|SPLICE_F_MORE));
+        PROBE2(splice__done, a->ifd, r);
+        Sc_count(SC_SPLICE, m, r);
         if (r < 0) {
-            if (errno == EAGAIN || errno == EINTR) continue;
+            if (errno == EINTR) continue;
 
-            progressbar_err(&p);
+            // Either end may be the one that isn't ready.
+            if (errno == EAGAIN && Io_wait(a->ifd, POLLIN) == 0 && Io_wait(a->ofd, POLLOUT) == 0)
+                continue;
+
+            Reporter_stop(0);
             error(1, errno, "I/O error while splicing around offset %" PRIu64 "", g->nrd);
         }
-        if (r == 0) break;
-
-        progressbar_update(&p, r);
+        if (r == 0) {
+            // EOF on this input; move on to the next one.
+            if (Next_input(a) == 0) continue;
+            break;
+        }
 
-        g->nrd += r;
-        g->nwr += r;
+        Acct_add(&g->nrd, r);
+        Acct_add(&g->nwr, r);
         if (n > 0) {
             n -= r;
             if (n == 0) done = 1;
         }
+
+        Ratelimit(&rl, r);
     }
 
-    progressbar_finish(&p, 1, 0);
+    Acct_fold(g);
     return 0;
 }
 
@@ -105,60 +131,329 @@ Copy(Acctg *g, Args *a)
 static int
 pipe_splice_sequential(Acctg *g, Args *a)
 {
-    off_t ioff = a->skip,
-          ooff = a->seek;
+    off_t ooff = a->seek;
     uint64_t n = a->insize;
+    uint64_t io, al;
+    int64_t held = 0;   // bytes in our pipe short of an aligned boundary
     int done   = 0;
 
     int fd[2];
 
-    progress p;
+    Ratelimit rl;
+
+    Ratelimit_init(&rl, a->rate, a->burst);
 
     if (pipe(fd) < 0) error(1, errno, "can't create pipe for splicing");
 
-    progressbar_init(&p, Quiet ? -1 : 2, a->insize, P_HUMAN);
+    // A pipe holds 64k by default; large I/O (e.g., for spinning
+    // disks) needs a bigger one. Best effort: pipe-max-size caps it.
+    if (a->iosize > pipesize(fd[0])) fcntl(fd[1], F_SETPIPE_SZ, (int)a->iosize);
+
+    Trace_thread("splice");
+
+    // Our pipe never holds more than a chunk; it must fit or the
+    // splice into the pipe blocks forever. The bytes past the last
+    // aligned boundary stay in it across reads - if they leave room
+    // for the next read.
+    io = a->iosize;
+    if (pipesize(fd[0]) > 0 && io > pipesize(fd[0])) io = pipesize(fd[0]);
+
+    al = 2 * a->oalign <= io ? a->oalign : 0;
+
+    g->engine = "splice-pipe";
+    g->iosize = io;
+    g->bufmem = pipesize(fd[0]);
+
+    if (a->skip > 0) {
+        int r = skip_input(a, a->skip);
+        if (r < 0) error(1, -r, "can't skip %" PRIu64 " bytes from %s", a->skip, a->infile);
+    }
 
     while (!done) {
-        size_t  m = n > 0 && n <= a->iosize ? n : a->iosize;
-        ssize_t r = splice(a->ifd, &ioff, fd[1], 0, m, SPLICE_F_MOVE|SPLICE_F_MORE);
-        if (r < 0) {
-            if (errno == EAGAIN || errno == EINTR) continue;
+        size_t  m = io - held;
+        int     fl = SPLICE_F_MOVE|SPLICE_F_MORE;
+        int     stall = 0;  // no more input just now
+        ssize_t r;
+
+        if (n > 0 && n < m) m = n;
+
+        // Bytes are only held to align the writes; don't block on
+        // the input (or on our full pipe) with them.
+        if (held > 0) fl |= SPLICE_F_NONBLOCK;
+
+        if (g->pipewait) pipe_wait(g, a);
 
-            progressbar_err(&p);
-            error(1, errno, "I/O read error while splicing around offset %" PRIu64 "", ioff);
+        PROBE2(read__start, a->ifd, m);
+        TIMED(g, LAT_RD, r = splice(a->ifd, 0, fd[1], 0, m, fl));
+        PROBE2(chunk__read, a->ifd, r);
+        Sc_count(SC_IN, m, r);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN && held > 0) {
+                stall = 1;
+                r     = 0;
+            } else if (errno == EAGAIN && Io_wait(a->ifd, POLLIN) == 0) {
+                continue;
+            } else {
+                Reporter_stop(0);
+                error(1, errno, "%s: I/O read error while splicing around offset %" PRIu64 "",
+                        a->infile, a->skip + g->nrd);
+            }
+        } else if (r == 0) {
+            // EOF on this input; move on to the next one.
+            if (Next_input(a) == 0) continue;
+            done = 1;
         }
-        if (r == 0) break;
 
-        g->nrd += r;
-        g->nwr += r;
+        Acct_add(&g->nrd, r);
         if (n > 0) {
             n -= r;
             if (n == 0) done = 1;
         }
 
+        Ratelimit(&rl, r);
+        held += r;
+
+        // Gather the short reads from a pipe into a full chunk. Then
+        // write up to the last aligned boundary and keep the rest for
+        // the next read; all of it at the end, or if our pipe filled
+        // up before we got to a boundary.
+        if (al > 0 && a->ipipe && !done && !stall && held < (int64_t)io) continue;
+
+        r = held;
+        if (al > 0 && !done) r -= (ooff + held) % al;
+        if (r <= 0) {
+            if (!stall) continue;
+            if (!pipe_full(fd[1])) {
+                Io_wait(a->ifd, POLLIN);
+                continue;
+            }
+            r = held;
+        }
+
+        held -= r;
+
         while (r > 0) {
-            ssize_t s = splice(fd[0], 0, a->ofd, &ooff, r, SPLICE_F_MOVE|SPLICE_F_MORE);
+            ssize_t s;
+
+            PROBE2(write__start, a->ofd, r);
+            TIMED(g, LAT_WR, s = splice(fd[0], 0, a->ofd, &ooff, r, SPLICE_F_MOVE|SPLICE_F_MORE));
+            PROBE2(chunk__write, a->ofd, s);
+            Sc_count(SC_OUT, r, s);
             if (s < 0) {
-                if (errno == EAGAIN || errno == EINTR) continue;
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN && Io_wait(a->ofd, POLLOUT) == 0) continue;
 
-                progressbar_err(&p);
+                Reporter_stop(0);
                 error(1, errno, "I/O write error while splicing around offset %" PRIu64 "", ooff);
             }
 
             r -= s;
-            progressbar_update(&p, s);
+            Acct_add(&g->nwr, s);
         }
     }
 
-    progressbar_finish(&p, 1, 0);
-
     close(fd[0]);
     close(fd[1]);
 
+    Acct_fold(g);
+    return 0;
+}
+
+
+/*
+ * Synthetic input (if=gen:): vmsplice(2) the generated buffer into
+ * a pipe and splice it to the output; there are no reads. Zeros come
+ * from one buffer that is filled once.
+ *
+ * When the output is itself a pipe, the reader at the other end may
+ * see the pages long after vmsplice returns; so only the (immutable)
+ * zero buffer is vmspliced into it - everything else is written.
+ *
+ * The buffer is page aligned and handed over at most a pipe-full at
+ * a time; an unaligned or larger vmsplice blocks forever on a pipe
+ * that nobody else drains.
+ */
+static int
+gen_splice(Acctg *g, Args *a)
+{
+    off_t ooff   = a->seek;
+    uint64_t n   = a->insize;
+    int direct   = a->opipe;
+    int zero     = a->gen.type == GEN_ZERO;
+    uint8_t *buf = 0;
+    int fd[2]    = { -1, -1 };
+    uint64_t psz;
+
+    Ratelimit rl;
+
+    Ratelimit_init(&rl, a->rate, a->burst);
+
+    if (!direct && pipe(fd) < 0) error(1, errno, "can't create pipe for splicing");
+
+    int r0 = posix_memalign((void **)&buf, sysconf(_SC_PAGESIZE), a->iosize);
+    if (r0 != 0) error(1, r0, "can't allocate %" PRIu64 " bytes", a->iosize);
+
+    psz = pipesize(direct ? a->ofd : fd[0]);
+    if (psz == 0) psz = 65536;
+
+    Trace_thread("splice");
+
+    g->engine = "gen-splice";
+    g->iosize = a->iosize;
+    g->bufmem = a->iosize + (direct ? 0 : psz);
+
+    if (a->skip > 0) skip_input(a, a->skip);
+
+    if (ooff > 0 && a->opipe)
+        die("can't seek %" PRIu64 " bytes of output pipe %s", ooff, a->outfile);
+
+    if (zero) Gen_fill(&a->gen, buf, a->iosize);
+
+    while (n > 0) {
+        size_t  m = Chunk_len(a, ooff, a->iosize);
+        ssize_t r;
+
+        if (n < m) m = n;
+
+        if (zero) {
+            Gen_skip(&a->gen, m);
+        } else {
+            Gen_fill(&a->gen, buf, m);
+        }
+
+        if (direct && !zero) {
+            PROBE2(write__start, a->ofd, m);
+            r = fullwrite_timed(g, a->ofd, buf, m);
+            PROBE2(chunk__write, a->ofd, r);
+            if (r < 0) {
+                Reporter_stop(0);
+                error(1, -r, "I/O write error on %s", a->outfile);
+            }
+            goto next;
+        }
+
+        int pfd = direct ? a->ofd : fd[1];
+        size_t done;
+
+        for (done = 0; done < m; ) {
+            size_t  want = (m - done) > psz ? psz : (m - done);
+            struct iovec iov = { .iov_base = buf + done, .iov_len = want };
+
+            PROBE2(read__start, pfd, want);
+            TIMED(g, LAT_RD, r = vmsplice(pfd, &iov, 1, 0));
+            PROBE2(chunk__read, pfd, r);
+            Sc_count(SC_IN, want, r);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN && Io_wait(pfd, POLLOUT) == 0) continue;
+
+                Reporter_stop(0);
+                error(1, errno, "vmsplice error around offset %" PRIu64 "", g->nrd + done);
+            }
+            done += r;
+
+            // Drain our pipe before handing over more of the buffer.
+            while (!direct && r > 0) {
+                ssize_t s;
+
+                PROBE2(write__start, a->ofd, r);
+                TIMED(g, LAT_WR, s = splice(fd[0], 0, a->ofd, &ooff, r, SPLICE_F_MOVE|SPLICE_F_MORE));
+                PROBE2(chunk__write, a->ofd, s);
+                Sc_count(SC_OUT, r, s);
+                if (s < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN && Io_wait(a->ofd, POLLOUT) == 0) continue;
+
+                    Reporter_stop(0);
+                    error(1, errno, "I/O write error while splicing around offset %" PRIu64 "", ooff);
+                }
+                r -= s;
+            }
+        }
+
+next:
+        Acct_add(&g->nrd, m);
+        Acct_add(&g->nwr, m);
+        n -= m;
+
+        Ratelimit(&rl, m);
+    }
+
+    if (!direct) {
+        close(fd[0]);
+        close(fd[1]);
+    }
+
+    free(buf);
+    Acct_fold(g);
     return 0;
 }
 
 
+/*
+ * Wait for the pipe ends of the splice to be ready; this keeps the
+ * time spent waiting on the process at the other end of the pipe
+ * out of the splice time.
+ */
+static void
+pipe_wait(Acctg *g, Args *a)
+{
+    struct pollfd p;
+
+    if (a->ipipe) {
+        p.fd     = a->ifd;
+        p.events = POLLIN;
+        TIMED(g, EV_PIPE_WAIT, poll(&p, 1, -1));
+    }
+
+    if (a->opipe) {
+        p.fd     = a->ofd;
+        p.events = POLLOUT;
+        TIMED(g, EV_PIPE_WAIT, poll(&p, 1, -1));
+    }
+}
+
+
+/*
+ * Return true if nothing more can be written to pipe 'fd' now.
+ */
+static int
+pipe_full(int fd)
+{
+    struct pollfd p = { .fd = fd, .events = POLLOUT };
+
+    return poll(&p, 1, 0) == 0;
+}
+
+
+/*
+ * Return the capacity of pipe 'fd' (0 if we can't tell).
+ */
+static uint64_t
+pipesize(int fd)
+{
+    int r = fcntl(fd, F_GETPIPE_SZ);
+
+    return r < 0 ? 0 : r;
+}
+
+
+/*
+ * Return true if every input is a pipe.
+ */
+static int
+allpipes(Args *a)
+{
+    int i;
+
+    for (i = 0; i < a->ninputs; i++) {
+        if (!a->inputs[i].pipe) return 0;
+    }
+    return 1;
+}
+
+
 #if 0
 
 /*
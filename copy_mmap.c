@@ -0,0 +1,147 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * copy_mmap.c - mmap(2) engine: write(2) straight out of a mapping
+ *               of the input.
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ *
+ * o  Only for inputs with a size: regular files and block devices.
+ *
+ * o  The input is mapped one window of iosize bytes (rounded up to
+ *    a page) at a time; the read(2) and its copy are replaced by
+ *    page faults. The first window is shorter if that aligns the
+ *    writes to the output (see Chunk_len()).
+ */
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "error.h"
+#include "fastdd.h"
+#include "probes.h"
+
+
+/*
+ * Return the mapping window for 'a'; a whole number of pages.
+ */
+uint64_t
+Mmap_iosize(Args *a)
+{
+    uint64_t pg = sysconf(_SC_PAGESIZE);
+
+    return (a->iosize + pg - 1) & ~(pg - 1);
+}
+
+
+int
+Copy_mmap(Acctg *g, Args *a)
+{
+    uint64_t pg = sysconf(_SC_PAGESIZE);
+    uint64_t io = Mmap_iosize(a);
+    uint64_t n  = a->insize;
+    uint64_t ooff = a->seek;
+    int done    = 0;
+    Ratelimit rl;
+
+    Ratelimit_init(&rl, a->rate, a->burst);
+
+    Trace_thread("mmap");
+
+    g->engine = "mmap";
+    g->iosize = io;
+    g->bufmem = io;
+
+    if (a->skip > 0) {
+        int r = skip_input(a, a->skip);
+        if (r < 0) error(1, -r, "can't skip %" PRIu64 " bytes from %s", a->skip, a->infile);
+    }
+
+    if (a->seek > 0) {
+        if (a->opipe)
+            die("can't seek %" PRIu64 " bytes of output pipe %s", a->seek, a->outfile);
+
+        Sc.calls[SC_SEEK]++;
+        if (lseek(a->ofd, a->seek, SEEK_SET) < 0)
+            error(1, errno, "%s: can't seek %" PRIu64 " bytes", a->outfile, a->seek);
+    }
+
+    while (!done) {
+        off_t    off = lseek(a->ifd, 0, SEEK_CUR);
+        uint64_t sz  = a->ist.st_size;
+
+        Sc.calls[SC_SEEK]++;
+
+        if (off < 0) error(1, errno, "%s: can't find offset", a->infile);
+
+        while ((uint64_t)off < sz) {
+            uint64_t m    = sz - off;
+            off_t    base = off & ~(pg - 1);
+            uint64_t lead = off - base;
+
+            uint64_t c    = Chunk_len(a, ooff, io);
+
+            if (m > c)           m = c;
+            if (n > 0 && m > n)  m = n;
+
+            PROBE2(read__start, a->ifd, m);
+            void *p = mmap(0, m + lead, PROT_READ, MAP_SHARED, a->ifd, base);
+            Sc_count(SC_IN, m, p == MAP_FAILED ? -1 : (ssize_t)m);
+            if (p == MAP_FAILED) {
+                Reporter_stop(0);
+                error(1, errno, "%s: can't mmap %" PRIu64 " bytes at offset %" PRIu64 "",
+                        a->infile, m + lead, (uint64_t)base);
+            }
+            madvise(p, m + lead, MADV_SEQUENTIAL);
+            PROBE2(chunk__read, a->ifd, m);
+            Acct_add(&g->nrd, m);
+
+            ssize_t z = m;
+
+            PROBE2(write__start, a->ofd, m);
+            if (!a->onull) {
+                z = fullwrite_timed(g, a->ofd, (uint8_t *)p + lead, m);
+            }
+            PROBE2(chunk__write, a->ofd, z);
+            munmap(p, m + lead);
+
+            if (z < 0) {
+                Reporter_stop(0);
+                error(1, -z, "write error on %s", a->outfile);
+            }
+
+            Acct_add(&g->nwr, z);
+            Ratelimit(&rl, z);
+            ooff += z;
+
+            off += m;
+            if (n > 0) {
+                n -= m;
+                if (n == 0) {
+                    done = 1;
+                    break;
+                }
+            }
+        }
+
+        if (!done && Next_input(a) < 0) break;
+    }
+
+    Acct_fold(g);
+    return 0;
+}
@@ -1,7 +1,7 @@
 /* vim: expandtab:tw=68:ts=4:sw=4:
  *
- * copy_posix.c - threaded copy for non-Linux posix
- * systems.
+ * copy_posix.c - threaded copy engine; the default on non-Linux
+ * posix systems.
  *
  * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
  *
@@ -24,6 +24,9 @@
  *
  * o  A producer-consumer queue of descriptors synchronizes the read
  *    and write threads.
+ *
+ * o  With conv=noerror, a failed read of a file or device is redone
+ *    by Read_rescue() from where it started; see badmap.c.
  */
 
 #include <errno.h>
@@ -37,9 +40,9 @@
 
 #include "error.h"
 #include "utils/new.h"
-#include "utils/progbar.h"
 #include "fast/syncq.h"
 #include "fastdd.h"
+#include "probes.h"
 
 
 /*
@@ -71,13 +74,17 @@ SYNCQ_TYPEDEF(desc_queue, desc*, DESC_QSIZE);
  * Context for buffered I/O read iterator/
  */
 struct bufiter {
-    int fd;
+    Args  *args;
+    Acctg *acc;
     uint64_t len;
 
     int done;
     uint64_t total;
     desc_queue *free;
 
+    // conv=noerror: offset of the current input; -1 if we don't
+    // track it (a pipe or no rescue)
+    int64_t ioff;
 };
 typedef struct bufiter bufiter;
 
@@ -100,10 +107,12 @@ struct context {
 };
 typedef struct context context;
 
-static int    bufiter_init(bufiter *ii, int fd, uint64_t len, desc_queue *free);
+static int    bufiter_init(bufiter *ii, Args *a, Acctg *g, uint64_t len, desc_queue *free);
 static desc*  bufiter_start(void *ii);
 static desc*  bufiter_next(void *ii);
 static uint64_t bufiter_fini(void *ii);
+static int64_t  fullread_input(bufiter *ii, uint8_t *buf, size_t n);
+static int64_t  input_off(Args *a, Acctg *g);
 
 static int    buf_writer(void *v);
 static void*  io_reader_thread(void *v);
@@ -113,7 +122,7 @@ static void*  io_reader_thread(void *v);
  * Copy from aa->ifd to aa->ofd
  */
 int
-Copy(Acctg *g, Args *aa)
+Copy_posix(Acctg *g, Args *aa)
 {
     ssize_t r;
     desc_queue avail,
@@ -129,12 +138,26 @@ Copy(Acctg *g, Args *aa)
         .acc  = g,
     };
 
-    desc    *dpool = NEWZA(desc,   DESC_QSIZE);
-    uint8_t *bpool = NEWA(uint8_t, DESC_QSIZE * aa->iosize);
+    // Number of buffers in flight; see tune_io() in args.c
+    int nbufs = aa->qdepth > 0 && aa->qdepth < DESC_QSIZE ? aa->qdepth : DESC_QSIZE;
+
+    // Page aligned buffers satisfy O_DIRECT on every device we know.
+    size_t   pg    = sysconf(_SC_PAGESIZE);
+    size_t   algn  = aa->align > pg ? aa->align : pg;
+    desc    *dpool = NEWZA(desc, nbufs);
+    void    *bpool = 0;
+
+    if ((r = posix_memalign(&bpool, algn, nbufs * aa->iosize)) != 0)
+        error(1, r, "can't allocate %d I/O buffers", nbufs);
+
+    g->engine = "posix";
+    g->iosize = aa->iosize;
+    g->bufmem = nbufs * (aa->iosize + sizeof(desc));
+    g->qsize  = nbufs;
 
-    for (r = 0; r < DESC_QSIZE; r++) {
+    for (r = 0; r < nbufs; r++) {
         desc *d    = &dpool[r];
-        uint8_t *b = &bpool[r * aa->iosize];
+        uint8_t *b = (uint8_t *)bpool + (r * aa->iosize);
 
         d->buf = b;
         d->cap = aa->iosize;
@@ -143,7 +166,7 @@ Copy(Acctg *g, Args *aa)
     }
 
     if (aa->skip > 0) {
-        r = aa->ipipe ? skip(aa->ifd, aa->skip) : lseek(aa->ifd, aa->skip, SEEK_SET);
+        r = skip_input(aa, aa->skip);
         if (r < 0)
             error(1, -r, "%s: can't skip %" PRIu64 "bytes from input", aa->infile, aa->skip);
     }
@@ -152,12 +175,12 @@ Copy(Acctg *g, Args *aa)
         if (aa->opipe)
             die("can't seek on output pipe %s", aa->outfile);
 
-        r = lseek(aa->ofd, aa->seek, SEEK_SET);
-        if (r < 0)
-            error(1, -r, "%s: can't seek %" PRIu64 "bytes for output", aa->outfile, aa->seek);
+        Sc.calls[SC_SEEK]++;
+        if (lseek(aa->ofd, aa->seek, SEEK_SET) < 0)
+            error(1, errno, "%s: can't seek %" PRIu64 "bytes for output", aa->outfile, aa->seek);
     }
 
-    r = bufiter_init(&c.b, aa->ifd, aa->insize, c.free);
+    r = bufiter_init(&c.b, aa, g, aa->insize, c.free);
     if (r != 0) error(1, -r, "can't start I/O");
 
     // spawn new thread to read from ifd.
@@ -170,6 +193,9 @@ Copy(Acctg *g, Args *aa)
     r = buf_writer(&c);
 
     pthread_join(id, 0);
+    Acct_fold(g);
+
+    if (r != 0) Reporter_stop(0);
 
     if (r < 0) {
         error(1, -r, "write error on %s", aa->outfile);
@@ -180,7 +206,7 @@ Copy(Acctg *g, Args *aa)
     g->nrd = bufiter_fini(&c.b);
 
     DEL(dpool);
-    DEL(bpool);
+    free(bpool);
 
     SYNCQ_FINI(&avail);
     SYNCQ_FINI(&io);
@@ -189,8 +215,6 @@ Copy(Acctg *g, Args *aa)
 }
 
 
-#define progressbar_err(p)  progressbar_finish(p, 0, 1)
-
 /*
  * Output writer: reads from the prod-cons queue and writes to
  * output-fd. Errors in writing are captured as "negative" errno and
@@ -202,33 +226,52 @@ buf_writer(void *v)
     context *c = v;
     Args *a    = c->args;
     Acctg *g   = c->acc;
-    progress p;
+    Ratelimit rl;
+    uint64_t ooff = a->seek;
+
+    Ratelimit_init(&rl, a->rate, a->burst);
 
-    progressbar_init(&p, Quiet ? -1 : 2, a->insize, P_HUMAN);
+    Trace_thread("writer");
 
     while (1) {
-        desc *d = SYNCQ_DEQ(c->io);
+        desc *d;
 
-        if (d->size == 0) break;
+        PROBE1(queue__block, PQ_IO);
+        TIMED(g, EV_IO_DEQ, d = SYNCQ_DEQ(c->io));
+        PROBE1(queue__unblock, PQ_IO);
+        Acct_add(&g->ndeq, 1);
 
-        if (d->err  != 0) {
-            progressbar_err(&p);
-            return d->err;
-        }
+        // A failed read comes with size 0; check it before EOF.
+        if (d->err  != 0) return d->err;
+        if (d->size == 0) break;
 
-        int64_t z = fullwrite(a->ofd, d->buf, d->size);
-        if (z <= 0) {
-            progressbar_err(&p);
-            return -z;
+        int64_t z, e = 0;
+
+        PROBE2(write__start, a->ofd, d->size);
+        if (a->onull) {
+            z = d->size;
+        } else if (a->zfill != ZF_NONE) {
+            // oflag=discard: zeros may already be there (or be cheap)
+            z = Write_sparse(g, a, d->buf, d->size, ooff);
+            if (z >= 0) {
+                e = z;
+                z = d->size;
+            }
+        } else {
+            z = fullwrite_timed(g, a->ofd, d->buf, d->size);
         }
-
-        SYNCQ_ENQ(c->free, d);
-        g->nwr += z;
-        progressbar_update(&p, z);
+        PROBE2(chunk__write, a->ofd, z);
+        if (z <= 0) return z < 0 ? z : -EIO;
+
+        PROBE1(queue__block, PQ_FREE);
+        TIMED(g, EV_FREE_ENQ, SYNCQ_ENQ(c->free, d));
+        PROBE1(queue__unblock, PQ_FREE);
+        ooff += z;
+        Acct_add(&g->elided, e);
+        Acct_add(&g->nwr, z - e);
+        Ratelimit(&rl, z);
     }
 
-    // don't write a newline; only clear the current line
-    progressbar_finish(&p, 1, 0);
     return 0;
 }
 
@@ -242,12 +285,21 @@ io_reader_thread(void *v)
     context *c = v;
     desc *z;
 
+    Trace_thread("reader");
+
+    // nenq is bumped before the enqueue so that the queue depth seen
+    // by the reporter never goes negative.
     for (z = bufiter_start(&c->b); z->size > 0; z = bufiter_next(&c->b)) {
-        SYNCQ_ENQ(c->io, z);
+        Acct_add(&c->acc->nenq, 1);
+        PROBE1(queue__block, PQ_IO);
+        TIMED(c->acc, EV_IO_ENQ, SYNCQ_ENQ(c->io, z));
+        PROBE1(queue__unblock, PQ_IO);
     }
 
     // Last descriptor -- either EOF or an error. In either case, we
     // send it to the writer thread.
+    Acct_fold(c->acc);
+    Acct_add(&c->acc->nenq, 1);
     SYNCQ_ENQ(c->io, z);
 
     return 0;
@@ -261,13 +313,15 @@ io_reader_thread(void *v)
 
 
 static int
-bufiter_init(bufiter *ii, int fd, uint64_t len, desc_queue *free)
+bufiter_init(bufiter *ii, Args *a, Acctg *g, uint64_t len, desc_queue *free)
 {
     memset(ii, 0, sizeof *ii);
 
-    ii->fd   = fd;
+    ii->args = a;
+    ii->acc  = g;
     ii->len  = len;
     ii->free = free;
+    ii->ioff = input_off(a, g);
     return 0;
 }
 
@@ -282,7 +336,12 @@ static desc*
 bufiter_next(void *v)
 {
     bufiter *ii = v;
-    desc    *d  = SYNCQ_DEQ(ii->free);
+    Acctg   *g  = ii->acc;
+    desc    *d;
+
+    PROBE1(queue__block, PQ_FREE);
+    TIMED(g, EV_FREE_DEQ, d = SYNCQ_DEQ(ii->free));
+    PROBE1(queue__unblock, PQ_FREE);
 
     if (ii->done) {
         d->size = 0;
@@ -291,16 +350,22 @@ bufiter_next(void *v)
     }
 
     /*
-     * This one test covers three cases:
-     *  a) ii->len == 0: read till EOF (i.e., one full I/O block)
-     *  b) ii->len > iosize: read one I/O block
-     *  c) ii->len < iosize: read remainder.
+     * One I/O block (less the head that realigns an unaligned seek=
+     * to the output's alignment) or the remainder, if that's less;
+     * ii->len == 0 means read till EOF. fullread_input() gathers
+     * short reads from a pipe into a full block.
      */
-    uint64_t rem = (ii->len > 0 && ii->len <= d->cap) ? ii->len : d->cap;
-    int64_t z    = fullread(ii->fd, d->buf, rem);
+    uint64_t rem = Chunk_len(ii->args, ii->args->seek + ii->total, d->cap);
+    if (ii->len > 0 && ii->len < rem) rem = ii->len;
+    int64_t z;
+
+    PROBE2(read__start, ii->args->ifd, rem);
+    z = fullread_input(ii, d->buf, rem);
+    PROBE2(chunk__read, ii->args->ifd, z);
 
     if (z >= 0) {
         ii->total += z;
+        Acct_add(&g->nrd, z);
         d->size = z;
         d->err  = 0;
         if (ii->len > 0) {
@@ -308,9 +373,8 @@ bufiter_next(void *v)
             if (ii->len == 0) ii->done = 1;
         }
     } else {
-        // We want to return negative error numbers for read
-        // errors.
-        d->err  = (int)z;
+        // Read errors go to the writer as positive errno.
+        d->err  = (int)-z;
         d->size = 0;
     }
 
@@ -318,6 +382,64 @@ bufiter_next(void *v)
 }
 
 
+/*
+ * Read 'n' bytes from the logical input; a short read from one
+ * input is filled in from the next so that input boundaries don't
+ * produce short I/O blocks. Read errors are rescued into g->bad
+ * with conv=noerror.
+ */
+static int64_t
+fullread_input(bufiter *ii, uint8_t *buf, size_t n)
+{
+    Args   *a = ii->args;
+    Acctg  *g = ii->acc;
+    size_t  r = n;
+
+    // Synthetic input never runs dry and makes no syscalls.
+    if (a->gen.type != GEN_NONE) {
+        Gen_fill(&a->gen, buf, n);
+        return n;
+    }
+
+    while (r > 0) {
+        int64_t at = ii->ioff;
+        int64_t z  = fullread_timed(g, a->ifd, buf, r);
+
+        // conv=noerror: read it again from where we started, in
+        // pieces; the failed read may have moved the file offset.
+        if (z < 0 && at >= 0) {
+            z = Read_rescue(g->bad, a->ifd, buf, at, r, a->inputs[a->curin].dev.lbs);
+            Sc.calls[SC_SEEK]++;
+            if (lseek(a->ifd, at + z, SEEK_SET) < 0) return -errno;
+        }
+        if (z < 0) return z;
+        if (at >= 0) ii->ioff = at + z;
+
+        buf += z;
+        r   -= z;
+        if (r > 0) {
+            if (Next_input(a) < 0) break;
+            ii->ioff = input_off(a, g);
+        }
+    }
+    return n - r;
+}
+
+
+/*
+ * Return the offset of the current input if a failed read may have
+ * to be rescued from there; else -1. Called once per input.
+ */
+static int64_t
+input_off(Args *a, Acctg *g)
+{
+    if (!g->bad || a->ipipe || a->gen.type != GEN_NONE) return -1;
+
+    Sc.calls[SC_SEEK]++;
+    return lseek(a->ifd, 0, SEEK_CUR);
+}
+
+
 static uint64_t
 bufiter_fini(void *v)
 {
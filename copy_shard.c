@@ -0,0 +1,222 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * copy_shard.c - sharded copy engine for solid state devices
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ *
+ * o  SSDs and NVMe only get to their rated bandwidth with many
+ *    requests in flight. We run a->shards threads; each one claims
+ *    the next iosize chunk of the input and copies it with
+ *    pread(2)/pwrite(2) to the same relative offset of the output.
+ *    There is no queue and no ordering between the threads.
+ *
+ * o  Needs one seekable input of known size and a seekable output.
+ *
+ * o  Latencies are recorded per shard and folded into Acctg when the
+ *    shard is done; the byte counters are live.
+ *
+ * o  In the scan mode every read also goes to the region map; a read
+ *    error is mapped and the chunk skipped.
+ *
+ * o  With conv=noerror, a failed read is redone by Read_rescue().
+ *
+ * o  The chunks are laid out from the output's side: when seek= is
+ *    not aligned, the first chunk is short by 'pad' so that all the
+ *    others start on an aligned boundary (see Chunk_len()).
+ */
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "utils/new.h"
+#include "fastdd.h"
+#include "probes.h"
+
+struct shard
+{
+    Args  *args;
+    Acctg *acc;
+
+    uint64_t next;      // offset of the next unclaimed chunk, plus 'pad'
+    uint64_t len;       // bytes to copy
+    uint64_t io;
+    uint64_t pad;       // the first chunk is this much short of 'io'
+
+    int err;            // first error: +errno for reads, -errno for writes
+
+    pthread_mutex_t lock;   // serializes the fold into 'acc'
+};
+typedef struct shard shard;
+
+static void *shard_thread(void *v);
+
+
+int
+Copy_shard(Acctg *g, Args *a)
+{
+    int n = a->shards > 1 ? a->shards : 1;
+    pthread_t *id = NEWZA(pthread_t, n);
+    int i, r;
+
+    shard s = {
+        .args = a,
+        .acc  = g,
+        .len  = a->insize,
+        .io   = a->iosize,
+        .pad  = a->iosize - Chunk_len(a, a->seek, a->iosize),
+    };
+
+    pthread_mutex_init(&s.lock, 0);
+
+    g->engine = "shard";
+    g->iosize = a->iosize;
+    g->bufmem = n * a->iosize;
+    g->qsize  = n;
+
+    for (i = 0; i < n; i++) {
+        r = pthread_create(&id[i], 0, shard_thread, &s);
+        if (r != 0) error(1, r, "can't create shard %d", i);
+    }
+
+    for (i = 0; i < n; i++) pthread_join(id[i], 0);
+
+    pthread_mutex_destroy(&s.lock);
+    DEL(id);
+
+    if (s.err != 0) Reporter_stop(0);
+
+    if (s.err < 0) {
+        error(1, -s.err, "write error on %s", a->outfile);
+    } else if (s.err > 0) {
+        error(1, s.err, "read error on %s", a->infile);
+    }
+
+    return 0;
+}
+
+
+static void *
+shard_thread(void *v)
+{
+    shard *s  = v;
+    Args  *a  = s->args;
+    Acctg *g  = s->acc;
+    int    n  = a->shards > 1 ? a->shards : 1;
+    size_t pg = sysconf(_SC_PAGESIZE);
+    void  *buf = 0;
+    Ratelimit rl;
+    Acctg  l;       // this shard's latencies
+
+    memset(&l, 0, sizeof l);
+    l.timing  = g->timing;
+    l.tracing = g->tracing;
+
+    // Each shard gets its share of the rate.
+    Ratelimit_init(&rl, a->rate / n, a->burst / n);
+
+    Trace_thread("shard");
+
+    int r = posix_memalign(&buf, a->align > pg ? a->align : pg, s->io);
+    if (r != 0) error(1, r, "can't allocate shard buffer");
+
+    while (!__atomic_load_n(&s->err, __ATOMIC_RELAXED)) {
+        uint64_t v   = __atomic_fetch_add(&s->next, s->io, __ATOMIC_RELAXED);
+        uint64_t off = v > 0 ? v - s->pad : 0;
+        uint64_t end = v + s->io - s->pad;
+        if (off >= s->len) break;
+
+        size_t  m = (end < s->len ? end : s->len) - off;
+        size_t  k = 0;
+        size_t  e = 0;      // bytes elided by oflag=discard
+        ssize_t z;
+        int err = 0;
+        uint64_t t0 = g->scan ? timenow() : 0;
+
+        PROBE2(read__start, a->ifd, m);
+        while (k < m) {
+            TIMED(&l, LAT_RD, z = pread(a->ifd, (uint8_t *)buf + k, m - k, a->skip + off + k));
+            Sc_count(SC_IN, m - k, z);
+            if (z < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if (z < 0 && g->bad) {
+                k += Read_rescue(g->bad, a->ifd, (uint8_t *)buf + k, a->skip + off + k, m - k, a->inputs[0].dev.lbs);
+                if (k < m) err = EIO;
+                break;
+            }
+            if (z <= 0) {
+                err = z < 0 ? errno : EIO;      // EOF: the input shrank under us
+                break;
+            }
+            k += z;
+        }
+        PROBE2(chunk__read, a->ifd, k);
+
+        if (g->scan) {
+            Scan_add(g->scan, off, timenow() - t0, err);
+            if (err != 0) {
+                __atomic_fetch_add(&g->nerrors, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+        }
+
+        if (err == 0) {
+            __atomic_fetch_add(&g->nrd, m, __ATOMIC_RELAXED);
+
+            PROBE2(write__start, a->ofd, m);
+            if (a->zfill != ZF_NONE && !a->onull) {
+                z = Write_sparse(&l, a, buf, m, a->seek + off);
+                if (z < 0) err = z;
+                else       e   = z;
+            } else if (!a->onull) {
+                uint8_t *p = buf;
+
+                for (k = 0; k < m; ) {
+                    TIMED(&l, LAT_WR, z = pwrite(a->ofd, p + k, m - k, a->seek + off + k));
+                    Sc_count(SC_OUT, m - k, z);
+                    if (z < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+                    if (z <= 0) {
+                        err = z < 0 ? -errno : -EIO;
+                        break;
+                    }
+                    k += z;
+                }
+            }
+            PROBE2(chunk__write, a->ofd, m);
+        }
+
+        if (err != 0) {
+            __atomic_compare_exchange_n(&s->err, &(int){0}, err, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            break;
+        }
+
+        // nwr is read concurrently; it only ever goes up.
+        __atomic_fetch_add(&g->elided, e, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g->nwr, m - e, __ATOMIC_RELAXED);
+        Ratelimit(&rl, m);
+    }
+
+    free(buf);
+
+    pthread_mutex_lock(&s->lock);
+    for (r = 0; r < LAT_MAX; r++) Hist_merge(&g->lat[r], &l.lat[r]);
+    for (r = 0; r < EV_MAX; r++)  Acct_add(&g->busy_ns[r], l.busy_ns[r]);
+    pthread_mutex_unlock(&s->lock);
+
+    Acct_fold(g);
+    return 0;
+}
@@ -0,0 +1,421 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * copy_uring.c - io_uring(7) copy engine for linux
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ *
+ * o  One thread keeps a->qdepth chunks in flight: each chunk of the
+ *    input is read into its own buffer and written out from it to
+ *    the same relative offset of the output; the chunks are laid
+ *    out exactly as in the shard engine (see Chunk_len()).
+ *
+ * o  We talk to the kernel with the raw io_uring_setup(2) and
+ *    io_uring_enter(2) syscalls and the ring layout from
+ *    <linux/io_uring.h>; there is no dependency on liburing.
+ *
+ * o  Needs one seekable input of known size and a seekable output;
+ *    and a kernel with IORING_OP_READ and IORING_OP_WRITE (5.6).
+ *
+ * o  Every request counts as a call in status=syscalls; with timing
+ *    on, its latency is the time from submission to completion.
+ *
+ * o  With conv=noerror, a failed read is redone by Read_rescue();
+ *    with oflag=discard the chunk goes out via Write_sparse(). Both
+ *    are synchronous.
+ */
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "error.h"
+#include "utils/new.h"
+#include "fastdd.h"
+#include "probes.h"
+
+// Most requests in flight
+#define URING_MAXQ      256
+
+struct ring
+{
+    int fd;
+    int timing;             // stamp every request with its submit time
+
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    struct io_uring_sqe *sqes;
+
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    uint32_t nsubmit;       // sqes queued since the last enter
+
+    void  *sq_ptr, *cq_ptr;
+    size_t sq_sz, cq_sz, sqe_sz;
+};
+typedef struct ring ring;
+
+// A chunk in flight
+struct slot
+{
+    uint8_t *buf;
+    uint64_t off;           // offset relative to skip= and seek=
+    size_t   len;
+    size_t   done;          // bytes of the current op completed so far
+    int      wr;            // set when writing out
+    uint64_t t0;            // submit time, when timing
+};
+typedef struct slot slot;
+
+struct uring
+{
+    Args  *args;
+    Acctg *acc;
+    ring   r;
+
+    uint64_t next;          // offset of the next unclaimed chunk, plus 'pad'
+    uint64_t io;
+    uint64_t pad;           // the first chunk is this much short of 'io'
+
+    int err;                // first error: +errno for reads, -errno for writes
+};
+typedef struct uring uring;
+
+static int  claim(uring *u, slot *s);
+static void reap(uring *u, slot *s, int res, uint32_t *busy, Ratelimit *rl);
+static int  ring_init(ring *r, uint32_t depth);
+static void ring_fini(ring *r);
+static void ring_prep(ring *r, Args *a, slot *s);
+static int  ring_enter(ring *r, uint32_t wait);
+
+
+/*
+ * Return true if this kernel has what the engine needs.
+ */
+int
+Uring_ok(void)
+{
+    static int ok = -1;
+    ring r;
+
+    if (ok < 0) {
+        ok = ring_init(&r, 1) == 0;
+        if (ok) ring_fini(&r);
+    }
+    return ok;
+}
+
+
+int
+Copy_uring(Acctg *g, Args *a)
+{
+    uint32_t n  = a->qdepth < 1 ? 1 : a->qdepth > URING_MAXQ ? URING_MAXQ : a->qdepth;
+    size_t   pg = sysconf(_SC_PAGESIZE);
+    slot    *sl = NEWZA(slot, n);
+    uint32_t busy = 0, i;
+    uint8_t *mem  = 0;
+    Ratelimit rl;
+
+    uring u = {
+        .args = a,
+        .acc  = g,
+        .io   = a->iosize,
+        .pad  = a->iosize - Chunk_len(a, a->seek, a->iosize),
+    };
+
+    int z = ring_init(&u.r, n);
+    if (z < 0) error(1, -z, "can't set up io_uring");
+    u.r.timing = g->timing;
+
+    z = posix_memalign((void **)&mem, a->align > pg ? a->align : pg, n * u.io);
+    if (z != 0) error(1, z, "can't allocate uring buffers");
+
+    Ratelimit_init(&rl, a->rate, a->burst);
+
+    Trace_thread("uring");
+
+    g->engine = "uring";
+    g->iosize = u.io;
+    g->bufmem = n * u.io;
+    g->qsize  = n;
+
+    for (i = 0; i < n; i++) {
+        sl[i].buf = mem + i * u.io;
+        if (!claim(&u, &sl[i])) break;
+        busy++;
+    }
+
+    while (busy > 0) {
+        z = ring_enter(&u.r, 1);
+        if (z < 0) error(1, -z, "io_uring_enter");
+
+        uint32_t head = *u.r.cq_head;
+        uint32_t tail = __atomic_load_n(u.r.cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++) {
+            struct io_uring_cqe *c = &u.r.cqes[head & *u.r.cq_mask];
+
+            reap(&u, (slot *)(uintptr_t)c->user_data, c->res, &busy, &rl);
+        }
+        __atomic_store_n(u.r.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    ring_fini(&u.r);
+    free(mem);
+    DEL(sl);
+
+    Acct_fold(g);
+
+    if (u.err != 0) Reporter_stop(0);
+
+    if (u.err < 0) {
+        error(1, -u.err, "write error on %s", a->outfile);
+    } else if (u.err > 0) {
+        error(1, u.err, "read error on %s", a->infile);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Claim the next chunk for 's' and queue its read. Return false
+ * when there is nothing left (or we've failed).
+ */
+static int
+claim(uring *u, slot *s)
+{
+    Args    *a   = u->args;
+    uint64_t v   = u->next;
+    uint64_t off = v > 0 ? v - u->pad : 0;
+    uint64_t end = v + u->io - u->pad;
+
+    if (u->err || off >= a->insize) return 0;
+
+    u->next += u->io;
+    s->off   = off;
+    s->len   = (end < a->insize ? end : a->insize) - off;
+    s->done  = 0;
+    s->wr    = 0;
+
+    PROBE2(read__start, a->ifd, s->len);
+    ring_prep(&u->r, a, s);
+    return 1;
+}
+
+
+/*
+ * Handle the completion 'res' of the current op of 's': queue the
+ * rest of a short transfer, the write of a chunk that's been read or
+ * the read of the next chunk. '*busy' counts the slots in flight.
+ */
+static void
+reap(uring *u, slot *s, int res, uint32_t *busy, Ratelimit *rl)
+{
+    Args  *a    = u->args;
+    Acctg *g    = u->acc;
+    size_t want = s->len - s->done;
+    int64_t e   = 0;        // bytes elided by oflag=discard
+
+    if (u->r.timing) __timed(g, s->wr ? LAT_WR : LAT_RD, s->t0, timenow());
+    Sc_count(s->wr ? SC_OUT : SC_IN, want, res);
+
+    // Once we've failed, we only wait for the rest to land.
+    if (u->err) goto done;
+
+    if (res == -EINTR || res == -EAGAIN) {
+        ring_prep(&u->r, a, s);
+        return;
+    }
+
+    if (!s->wr) {
+        if (res < 0 && g->bad) {
+            s->done += Read_rescue(g->bad, a->ifd, s->buf + s->done, a->skip + s->off + s->done,
+                                   want, a->inputs[0].dev.lbs);
+            if (s->done < s->len) u->err = EIO;
+        } else if (res <= 0) {
+            u->err = res < 0 ? -res : EIO;      // EOF: the input shrank under us
+        } else {
+            s->done += res;
+        }
+    } else {
+        if (res <= 0) u->err = res < 0 ? res : -EIO;
+        else          s->done += res;
+    }
+
+    if (u->err) goto done;
+
+    if (s->done < s->len) {
+        ring_prep(&u->r, a, s);
+        return;
+    }
+
+    if (!s->wr) {
+        PROBE2(chunk__read, a->ifd, s->len);
+        __atomic_fetch_add(&g->nrd, s->len, __ATOMIC_RELAXED);
+
+        if (!a->onull && a->zfill == ZF_NONE) {
+            s->wr   = 1;
+            s->done = 0;
+            PROBE2(write__start, a->ofd, s->len);
+            ring_prep(&u->r, a, s);
+            return;
+        }
+
+        if (!a->onull) {
+            e = Write_sparse(g, a, s->buf, s->len, a->seek + s->off);
+            if (e < 0) {
+                u->err = e;
+                goto done;
+            }
+        }
+    }
+
+    // nwr is read concurrently; it only ever goes up.
+    PROBE2(chunk__write, a->ofd, s->len);
+    __atomic_fetch_add(&g->elided, e, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g->nwr, s->len - e, __ATOMIC_RELAXED);
+    Ratelimit(rl, s->len);
+
+    if (claim(u, s)) return;
+
+done:
+    (*busy)--;
+}
+
+
+/*
+ * Queue the rest of the current op of 's'.
+ */
+static void
+ring_prep(ring *r, Args *a, slot *s)
+{
+    uint32_t tail = *r->sq_tail;
+    uint32_t idx  = tail & *r->sq_mask;
+    struct io_uring_sqe *e = &r->sqes[idx];
+
+    memset(e, 0, sizeof *e);
+    e->opcode    = s->wr ? IORING_OP_WRITE : IORING_OP_READ;
+    e->fd        = s->wr ? a->ofd : a->ifd;
+    e->addr      = (uintptr_t)(s->buf + s->done);
+    e->len       = s->len - s->done;
+    e->off       = (s->wr ? a->seek : a->skip) + s->off + s->done;
+    e->user_data = (uintptr_t)s;
+
+    if (r->timing) s->t0 = timenow();
+
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->nsubmit++;
+}
+
+
+/*
+ * Submit what's queued and wait for at least 'wait' completions.
+ * Return 0 or -errno.
+ */
+static int
+ring_enter(ring *r, uint32_t wait)
+{
+    while (1) {
+        long z = syscall(__NR_io_uring_enter, r->fd, r->nsubmit, wait, IORING_ENTER_GETEVENTS, 0, 0);
+
+        if (z >= 0) {
+            r->nsubmit -= z;
+            if (r->nsubmit == 0) return 0;
+            wait = 0;
+            continue;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return -errno;
+    }
+}
+
+
+static int
+ring_init(ring *r, uint32_t depth)
+{
+    struct io_uring_params p;
+    int e;
+
+    memset(r, 0, sizeof *r);
+    memset(&p, 0, sizeof p);
+
+    r->fd = syscall(__NR_io_uring_setup, depth, &p);
+    if (r->fd < 0) return -errno;
+
+    // IORING_OP_READ and IORING_OP_WRITE arrived with this feature
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        close(r->fd);
+        return -ENOSYS;
+    }
+
+    r->sq_sz  = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    r->cq_sz  = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqe_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_sz > r->sq_sz) r->sq_sz = r->cq_sz;
+        r->cq_sz = 0;
+    }
+
+    r->sq_ptr = mmap(0, r->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) goto fail;
+
+    r->cq_ptr = r->sq_ptr;
+    if (r->cq_sz > 0) {
+        r->cq_ptr = mmap(0, r->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) goto fail;
+    }
+
+    r->sqes = mmap(0, r->sqe_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) goto fail;
+
+    r->sq_tail  = (uint32_t *)((uint8_t *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask  = (uint32_t *)((uint8_t *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (uint32_t *)((uint8_t *)r->sq_ptr + p.sq_off.array);
+
+    r->cq_head  = (uint32_t *)((uint8_t *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail  = (uint32_t *)((uint8_t *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask  = (uint32_t *)((uint8_t *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)((uint8_t *)r->cq_ptr + p.cq_off.cqes);
+    return 0;
+
+fail:
+    e = errno;
+
+    if (r->sq_ptr && r->sq_ptr != MAP_FAILED) munmap(r->sq_ptr, r->sq_sz);
+    if (r->cq_sz > 0 && r->cq_ptr && r->cq_ptr != MAP_FAILED) munmap(r->cq_ptr, r->cq_sz);
+    close(r->fd);
+    return -e;
+}
+
+
+static void
+ring_fini(ring *r)
+{
+    munmap(r->sqes, r->sqe_sz);
+    if (r->cq_sz > 0) munmap(r->cq_ptr, r->cq_sz);
+    munmap(r->sq_ptr, r->sq_sz);
+    close(r->fd);
+}
+
+/* EOF */
@@ -0,0 +1,201 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * discard_linux.c - oflag=discard: trim the output before a copy
+ *                   and elide writes of zero blocks afterwards.
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ *
+ * o  Block devices get BLKDISCARD and files get their blocks
+ *    deallocated with FALLOC_FL_PUNCH_HOLE; both in batches of
+ *    DISCARD_BATCH bytes aligned to the discard granularity.
+ *
+ * o  We only trim what the copy will overwrite. With a known size,
+ *    that's done up front; else (a pipe without count=) each write
+ *    trims its own whole granules just before it goes out.
+ *
+ * o  A punched file reads back zeros; so zero blocks of the input
+ *    need not be written at all. A discarded block device may read
+ *    back anything - zero blocks are sent as BLKZEROOUT if the
+ *    device can zero without a data transfer (write_zeroes); else
+ *    they are written as usual.
+ *
+ * o  Wipe_offload() has the same ioctls for the wipe mode (wipe.c).
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/falloc.h>
+
+#include "error.h"
+#include "fastdd.h"
+
+// Largest single discard; keeps each ioctl short
+#define DISCARD_BATCH   (1024ULL * 1048576)
+
+static int discard_range(Args *a, uint64_t off, uint64_t len);
+
+#ifndef BLKSECDISCARD
+#define BLKSECDISCARD   _IO(0x12,125)
+#endif
+
+
+int64_t
+Discard_output(Args *a)
+{
+    uint64_t gran, end;
+
+    if (a->onull || a->opipe) return 0;
+
+    if (S_ISBLK(a->ost.st_mode)) {
+        gran = a->odev.discard;
+        if (a->odev.wzmax > 0) a->zfill = ZF_ZEROOUT;
+    } else if (S_ISREG(a->ost.st_mode)) {
+        gran = a->ost.st_blksize;
+        a->zfill = ZF_SKIP;     // at least past EOF
+    } else {
+        return -ENOTSUP;
+    }
+
+    // Whole granules only; a partial one would be rounded out by the
+    // device and hit data we are not overwriting.
+    uint64_t off = gran > 0 ? ((a->seek + gran - 1) / gran) * gran : a->seek;
+
+    a->zlo = a->zhi = off;
+
+    // Only what we are about to overwrite. If we don't know how much
+    // that is, the writes trim their own range (Discard_ahead()).
+    if (a->insize == 0) {
+        if (gran == 0) return -ENOTSUP;
+        a->zgran = gran;
+        return 0;
+    }
+
+    end = a->seek + a->insize;
+    if (end > (uint64_t)a->ost.st_size) end = a->ost.st_size;
+
+    if (end <= a->seek) return 0;
+    if (gran == 0)      return -ENOTSUP;
+
+    end = (end / gran) * gran;
+    if (end <= off) return 0;
+
+    while (a->zhi < end) {
+        uint64_t n = end - a->zhi;
+        if (n > DISCARD_BATCH) n = (DISCARD_BATCH / gran) * gran;
+
+        int r = discard_range(a, a->zhi, n);
+        if (r < 0) {
+            if (a->zhi == off) return r;
+            break;
+        }
+        a->zhi += n;
+    }
+    return a->zhi - a->zlo;
+}
+
+
+/*
+ * The writes are sequential; so [zlo, zhi) is the last range we
+ * trimmed and anything before it has been written already.
+ */
+int64_t
+Discard_ahead(Args *a, uint64_t off, size_t n)
+{
+    uint64_t gran = a->zgran;
+    uint64_t end  = off + n;
+
+    if (gran == 0) return 0;
+
+    // Not the granule we may have partly written before 'off'
+    off = ((off + gran - 1) / gran) * gran;
+    if (off < a->zhi) off = a->zhi;
+
+    if (end > (uint64_t)a->ost.st_size) end = a->ost.st_size;
+    end = (end / gran) * gran;
+    if (end <= off) return 0;
+
+    int r = discard_range(a, off, end - off);
+    if (r < 0) {
+        a->zgran = 0;
+        return r;
+    }
+
+    if (off > a->zhi) a->zlo = off;
+    a->zhi = end;
+    return end - off;
+}
+
+
+int
+Zero_elide(Args *a, uint64_t off, size_t n)
+{
+    uint64_t rng[2] = { off, n };
+
+    switch (a->zfill) {
+        case ZF_SKIP:
+            // Holes we punched, or past the old EOF, read as zeros.
+            if (off >= a->zlo && (off + n) <= a->zhi) return 1;
+            if (off >= (uint64_t)a->ost.st_size)      return 1;
+            return 0;
+
+        case ZF_ZEROOUT:
+            // The kernel wants whole logical sectors.
+            if ((off | n) & ((a->odev.lbs ? a->odev.lbs : 512) - 1)) return 0;
+            if (ioctl(a->ofd, BLKZEROOUT, rng) == 0) return 1;
+            if (errno == EOPNOTSUPP || errno == EINVAL) a->zfill = ZF_NONE;
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+
+int
+Wipe_offload(Args *a, int tier, uint64_t off, uint64_t len)
+{
+    uint64_t rng[2] = { off, len };
+    int r;
+
+    switch (tier) {
+        case WIPE_SECDISCARD: r = ioctl(a->ofd, BLKSECDISCARD, rng); break;
+        case WIPE_DISCARD:    r = ioctl(a->ofd, BLKDISCARD, rng);    break;
+        case WIPE_ZEROOUT:    r = ioctl(a->ofd, BLKZEROOUT, rng);    break;
+        case WIPE_ZERORANGE:  r = fallocate(a->ofd, FALLOC_FL_ZERO_RANGE, off, len); break;
+        default:              return -ENOTSUP;
+    }
+    return r < 0 ? -errno : 0;
+}
+
+
+static int
+discard_range(Args *a, uint64_t off, uint64_t len)
+{
+    if (S_ISBLK(a->ost.st_mode)) {
+        uint64_t rng[2] = { off, len };
+
+        if (ioctl(a->ofd, BLKDISCARD, rng) < 0) return -errno;
+        return 0;
+    }
+
+    if (fallocate(a->ofd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, off, len) < 0) return -errno;
+    return 0;
+}
@@ -0,0 +1,64 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * discard_posix.c - oflag=discard for systems without a portable
+ *                   way to trim; only the zero write elision past
+ *                   the end of a file remains.
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "fastdd.h"
+
+
+int64_t
+Discard_output(Args *a)
+{
+    // Past EOF, a file is a hole.
+    if (!a->onull && !a->opipe && S_ISREG(a->ost.st_mode)) a->zfill = ZF_SKIP;
+
+    return -ENOTSUP;
+}
+
+
+int64_t
+Discard_ahead(Args *a, uint64_t off, size_t n)
+{
+    (void)a;
+    (void)off;
+    (void)n;
+
+    return 0;
+}
+
+
+int
+Zero_elide(Args *a, uint64_t off, size_t n)
+{
+    (void)n;
+
+    return a->zfill == ZF_SKIP && off >= (uint64_t)a->ost.st_size;
+}
+
+
+int
+Wipe_offload(Args *a, int tier, uint64_t off, uint64_t len)
+{
+    (void)a;
+    (void)tier;
+    (void)off;
+    (void)len;
+
+    return -ENOTSUP;
+}
@@ -9,7 +9,7 @@
 #include "fastdd.h"
 
 /*
- * Print disksize of every arg on the command line
+ * Print disksize and topology of every arg on the command line
  */
 int
 main(int argc, char *argv[])
@@ -33,6 +33,13 @@ main(int argc, char *argv[])
             humanize_size(buf, sizeof buf, sz);
             printf("%s: %s (%" PRIu64 ")\n", fn, buf, sz);
         }
+
+        Devinfo d;
+        if ((r = Devinfo_get(&d, fd)) < 0) {
+            printf("%s: topology %s\n", fn, strerror(-r));
+        } else {
+            Devinfo_print(stdout, &d);
+        }
         close(fd);
     }
     return 0;
@@ -0,0 +1,478 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * engine.c - pick one of the copy engines and explain the choice
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ *
+ * o  Every engine that can be built on this OS is compiled in;
+ *    engine=NAME picks one and engine=auto (the default) lets
+ *    Engine_pick() decide.
+ *
+ * o  An engine that can't do the copy at hand says why via its
+ *    unusable() method; that reason is what --explain prints.
+ *
+ * o  Write_sparse() is shared by the engines that see the data.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "fastdd.h"
+
+struct engine
+{
+    const char *name;
+    int (*copy)(Acctg *g, Args *a);
+
+    // Return 0 if the engine can copy 'a', else the reason it can't
+    const char * (*unusable)(Args *a);
+
+    // Effective iosize; 0 => a->iosize
+    uint64_t (*iosize)(Args *a);
+
+    int threads;    // 0 => a->shards
+    int pipe;       // set if data moves through a pipe
+};
+typedef struct engine engine;
+
+static const char *splice_unusable(Args *a);
+static const char *cfr_unusable(Args *a);
+static const char *posix_unusable(Args *a);
+static const char *mmap_unusable(Args *a);
+static const char *shard_unusable(Args *a);
+static const char *uring_unusable(Args *a);
+
+// The linux engines are left out elsewhere
+#ifndef __linux__
+#define Copy_splice     0
+#define Copy_cfr        0
+#define Cfr_iosize      0
+#define Copy_uring      0
+#endif
+
+static const engine Engines[] =
+{
+      {"splice", Copy_splice, splice_unusable, 0,           1, 1}
+    , {"cfr",    Copy_cfr,    cfr_unusable,    Cfr_iosize,  1, 0}
+    , {"posix",  Copy_posix,  posix_unusable,  0,           2, 0}
+    , {"mmap",   Copy_mmap,   mmap_unusable,   Mmap_iosize, 1, 0}
+    , {"shard",  Copy_shard,  shard_unusable,  0,           0, 0}
+    , {"uring",  Copy_uring,  uring_unusable,  0,           1, 0}
+    , {0, 0, 0, 0, 0, 0}
+};
+
+static const engine *Engine_find(const char *name);
+static const engine *Engine_pick(Args *a, const char **why);
+static int allregular(Args *a);
+static int allsamefs(Args *a);
+
+
+int
+Copy(Acctg *g, Args *a)
+{
+    const char *why;
+    const engine *e = Engine_pick(a, &why);
+
+    if (!e) die("engine=%s: %s", a->engine, why);
+
+    if (a->discard) {
+        int64_t n = Discard_output(a);
+
+        if (n < 0) error(0, -n, "%s: can't discard", a->outfile);
+        else       g->discarded = n;
+    }
+
+    int r = e->copy(g, a);
+
+    // Zero blocks skipped at the very end left the file short.
+    if (a->zfill == ZF_SKIP) {
+        uint64_t end = a->seek + g->nwr + g->elided;
+        struct stat st;
+
+        if (fstat(a->ofd, &st) == 0 && (uint64_t)st.st_size < end && ftruncate(a->ofd, end) < 0)
+            error(1, errno, "%s: can't extend to %" PRIu64 " bytes", a->outfile, end);
+    }
+    return r;
+}
+
+
+void
+Engine_explain(FILE *fp, Args *a)
+{
+    const char *why;
+    const engine *e = Engine_pick(a, &why);
+    const engine *x;
+
+    if (!e) {
+        fprintf(fp, "engine:    none (engine=%s: %s)\n", a->engine, why);
+        return;
+    }
+
+    uint64_t io = e->iosize ? e->iosize(a) : a->iosize;
+
+    // as decided by Copy_splice()
+    int ownpipe = !a->opipe && (!a->ipipe || a->oalign > 0);
+
+    fprintf(fp, "engine:    %s (%s)\n", e->name, why);
+    fprintf(fp, "iosize:    %" PRIu64 " bytes\n", io);
+
+    if (e->pipe) {
+        int psz = -1;
+#ifdef F_GETPIPE_SZ
+        int fd[2];
+
+        if (a->opipe)            psz = fcntl(a->ofd, F_GETPIPE_SZ);
+        else if (ownpipe == 0)   psz = fcntl(a->ifd, F_GETPIPE_SZ);
+        else if (pipe(fd) == 0) {
+            // as done by the splice engine
+            if (io > (uint64_t)fcntl(fd[0], F_GETPIPE_SZ)) fcntl(fd[1], F_SETPIPE_SZ, (int)io);
+            psz = fcntl(fd[0], F_GETPIPE_SZ);
+            close(fd[0]);
+            close(fd[1]);
+        }
+#endif
+        if (psz > 0) fprintf(fp, "pipe:      %d bytes%s\n", psz,
+                                 ownpipe ? " (intermediate pipe)" : "");
+        else         fprintf(fp, "pipe:      unknown\n");
+    } else {
+        fprintf(fp, "pipe:      none\n");
+    }
+
+    fprintf(fp, "threads:   %d\n", e->threads ? e->threads : (int)a->shards);
+    if (e->threads > 1) fprintf(fp, "queue:     %u buffers\n", a->qdepth);
+
+    fprintf(fp, "devices:   %s\n", a->rotational == 1 ? "rotational; one sequential stream" :
+                                    a->rotational == 0 ? "solid state; concurrent shards" :
+                                                         "unknown");
+
+    if (a->align > 0) fprintf(fp, "alignment: %u bytes (O_DIRECT)\n", a->align);
+    else              fprintf(fp, "alignment: none (buffered I/O)\n");
+
+    if (a->oalign > 0) {
+        uint64_t h = Chunk_len(a, a->seek, io);
+
+        fprintf(fp, "writes:    aligned to %u bytes", a->oalign);
+        if (h < io) fprintf(fp, " after a %" PRIu64 " byte head chunk", h);
+        fputc('\n', fp);
+    }
+
+    fprintf(fp, "candidates:\n");
+    for (x = Engines; x->name; x++) {
+        const char *r = x->unusable(a);
+
+        fprintf(fp, "    %-8s %s%s\n", x->name, r ? "no: " : "usable", r ? r : "");
+    }
+}
+
+
+/*
+ * Return the engine to use for 'a' and in '*why' the reason; on
+ * failure return 0 with the error in '*why'.
+ */
+static const engine *
+Engine_pick(Args *a, const char **why)
+{
+    const engine *e;
+
+    // Only the shard engine knows the offset of every read.
+    if (a->mode == MODE_SCAN) {
+        if (0 != strcmp(a->engine, "auto") && 0 != strcmp(a->engine, "shard")) {
+            *why = "scan mode only uses the shard engine";
+            return 0;
+        }
+        e = Engine_find("shard");
+        if ((*why = e->unusable(a))) return 0;
+
+        *why = "scan mode maps the latency of every read";
+        return e;
+    }
+
+    if (0 != strcmp(a->engine, "auto")) {
+        e = Engine_find(a->engine);
+        if (!e) {
+            *why = "unknown engine (try auto, splice, posix, uring, cfr, mmap or shard)";
+            return 0;
+        }
+
+        if ((*why = e->unusable(a))) return 0;
+
+        *why = "engine= on the command line";
+        return e;
+    }
+
+    /*
+     * Solid state devices want many requests in flight; spinning
+     * ones want one sequential stream (any of the others). Rate
+     * limited copies stay sequential.
+     */
+    int shardok = a->rotational == 0 && a->shards > 1 && a->rate == 0 && !shard_unusable(a);
+
+    // Zero blocks are only seen by the engines that handle the data.
+    if (a->discard) {
+        *why = "auto: oflag=discard elides zero blocks";
+        return Engine_find(shardok ? "shard" : "posix");
+    }
+
+    // .. and only they can redo a failed read in pieces.
+    if (a->conv & CONV_NOERROR) {
+        *why = "auto: conv=noerror reads around bad sectors";
+        return Engine_find(shardok ? "shard" : "posix");
+    }
+
+#ifdef __linux__
+    // The kernel can copy file to file without any help from us; on
+    // the same filesystem, it may not even copy (reflink).
+    if (!cfr_unusable(a) && (!shardok || allsamefs(a))) {
+        *why = a->rotational == 1 ? "auto: regular files on a rotational device; one sequential stream"
+                                  : "auto: all inputs and the output are regular files";
+        return Engine_find("cfr");
+    }
+
+    if (shardok) {
+        *why = "auto: solid state devices; concurrent shards";
+        return Engine_find("shard");
+    }
+
+    *why = a->gen.type != GEN_NONE ? "auto: synthetic input is vmspliced" :
+           a->rotational == 1      ? "auto: rotational device; one sequential stream"
+                                   : "auto: an input or the output is not a regular file";
+    return Engine_find("splice");
+#else
+    if (shardok) {
+        *why = "auto: solid state devices; concurrent shards";
+        return Engine_find("shard");
+    }
+
+    *why = "auto: the only general engine on this OS";
+    return Engine_find("posix");
+#endif
+}
+
+
+static const engine *
+Engine_find(const char *name)
+{
+    const engine *e;
+
+    for (e = Engines; e->name; e++) {
+        if (0 == strcmp(e->name, name)) return e;
+    }
+    return 0;
+}
+
+
+/*
+ * Return true if all inputs are on the same filesystem as the
+ * output.
+ */
+static int
+allsamefs(Args *a)
+{
+    int i;
+
+    for (i = 0; i < a->ninputs; i++) {
+        if (a->inputs[i].st.st_dev != a->ost.st_dev) return 0;
+    }
+    return 1;
+}
+
+
+/*
+ * Return true if all inputs are regular files.
+ */
+static int
+allregular(Args *a)
+{
+    int i;
+
+    for (i = 0; i < a->ninputs; i++) {
+        if (!S_ISREG(a->inputs[i].st.st_mode)) return 0;
+    }
+    return 1;
+}
+
+
+static const char *
+splice_unusable(Args *a)
+{
+#ifdef __linux__
+    if (a->conv & CONV_NOERROR)   return "conv=noerror";
+    return 0;
+#else
+    (void)a;
+    return "linux only";
+#endif
+}
+
+
+static const char *
+cfr_unusable(Args *a)
+{
+#ifdef __linux__
+    if (a->conv & CONV_NOERROR)   return "conv=noerror";
+    if (a->gen.type != GEN_NONE)  return "synthetic input";
+    if (a->onull)                 return "output is discarded";
+    if (!allregular(a))           return "an input is not a regular file";
+    if (!S_ISREG(a->ost.st_mode)) return "output is not a regular file";
+    return 0;
+#else
+    (void)a;
+    return "linux only";
+#endif
+}
+
+
+static const char *
+posix_unusable(Args *a)
+{
+    (void)a;
+    return 0;
+}
+
+
+static const char *
+mmap_unusable(Args *a)
+{
+    int i;
+
+    if (a->conv & CONV_NOERROR)  return "conv=noerror";
+    if (a->gen.type != GEN_NONE) return "synthetic input";
+
+    for (i = 0; i < a->ninputs; i++) {
+        mode_t m = a->inputs[i].st.st_mode;
+
+        if (!(S_ISREG(m) || S_ISBLK(m))) return "an input is not a file or block device";
+    }
+    return 0;
+}
+
+
+static const char *
+shard_unusable(Args *a)
+{
+    const Input *in = &a->inputs[0];
+
+    if (a->gen.type != GEN_NONE) return "synthetic input";
+    if (a->ninputs != 1)         return "more than one input";
+    if (a->insize == 0)          return "input size is unknown";
+
+    if (in->pipe || !(S_ISREG(in->st.st_mode) || S_ISBLK(in->st.st_mode)))
+        return "input is not a file or block device";
+
+    if (!a->onull && (a->opipe || !(S_ISREG(a->ost.st_mode) || S_ISBLK(a->ost.st_mode))))
+        return "output is not a file or block device";
+
+    return 0;
+}
+
+
+/*
+ * Same constraints as the shard engine; and a kernel with io_uring.
+ */
+static const char *
+uring_unusable(Args *a)
+{
+#ifdef __linux__
+    const char *r = shard_unusable(a);
+
+    if (r)           return r;
+    if (!Uring_ok()) return "io_uring is unavailable or too old (needs linux 5.6)";
+    return 0;
+#else
+    (void)a;
+    return "linux only";
+#endif
+}
+
+
+/*
+ * oflag=discard: write 'n' bytes at 'buf' to output offset 'off';
+ * zero runs of ZRUN bytes or more (found in ZBLK units) are handed to
+ * Zero_elide() instead. Shorter ones aren't worth the extra
+ * syscalls. I/O is timed against 't'; and trims ahead of the write
+ * (only done by the single writer of a copy of unknown size) are
+ * counted in it.
+ * Return the number of bytes elided, -errno on failure.
+ */
+int64_t
+Write_sparse(Acctg *t, Args *a, const uint8_t *buf, size_t n, uint64_t off)
+{
+    uint64_t elided = 0;
+    size_t i = 0;
+    int64_t d = Discard_ahead(a, off, n);
+
+    if (d > 0) Acct_add(&t->discarded, d);
+
+    while (i < n) {
+        size_t j = i, z = i;
+
+        // Find the next zero run [z, j) that is long enough; data
+        // and short zero runs before it go out in one write.
+        while (j < n) {
+            size_t m = n - j > ZBLK ? ZBLK : n - j;
+
+            if (!iszero(buf + j, m)) {
+                j += m;
+                z  = j;
+                continue;
+            }
+            j += m;
+            if ((j - z) >= ZRUN && (j == n || !iszero(buf + j, n - j > ZBLK ? ZBLK : n - j)))
+                break;
+        }
+
+        if ((j - z) >= ZRUN && Zero_elide(a, off + z, j - z)) {
+            elided += j - z;
+        } else {
+            z = j;
+        }
+
+        while (i < z) {
+            ssize_t w;
+
+            TIMED(t, LAT_WR, w = pwrite(a->ofd, buf + i, z - i, off + i));
+            Sc_count(SC_OUT, z - i, w);
+            if (w < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if (w <= 0) return w < 0 ? -errno : -EIO;
+            i += w;
+        }
+        i = j;
+    }
+    return elided;
+}
+
+
+/*
+ * The alignment-aware chunk scheduler; see fastdd.h. A chunk that
+ * can't reach the next boundary is left at 'max'.
+ */
+uint64_t
+Chunk_len(Args *a, uint64_t ooff, uint64_t max)
+{
+    uint64_t al = a->oalign;
+    uint64_t end;
+
+    if (al == 0) return max;
+
+    end = ((ooff + max) / al) * al;
+    return end > ooff ? end - ooff : max;
+}
+
+/* EOF */
@@ -23,7 +23,7 @@
  *   count=N
  *   skip=N     -- skip N input blocks
  *   seek=N     -- skip N output blocks before first write
- *   if=FILE
+ *   if=FILE[,FILE...]
  *   of=FILE
  *   iflag=nonblock
  *   oflag=nonblock,excl,sync
@@ -47,9 +47,12 @@
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #include "error.h"
 #include "fastdd.h"
+#include "probes.h"
 #include "utils/utils.h"
 
 // Auto-generated headerfile
@@ -57,6 +60,38 @@
 
 int Quiet = 0;
 
+/*
+ * Where the copy spent its time, as a percentage of the copy's wall
+ * time. In the threaded engine the reader and writer overlap, so the
+ * shares can add up to more than 100%.
+ */
+#define TS_SOURCE   0   // blocked in input I/O
+#define TS_SINK     1   // blocked in output I/O
+#define TS_PIPE     2   // waiting on the process at the other end of a pipe
+#define TS_CPU      3   // user CPU
+#define TS_QUEUE    4   // waiting on the reader/writer queues
+#define TS_MAX      5
+
+static const char *Tsnames[TS_MAX] = {
+    "source", "sink", "pipe", "cpu", "queue",
+};
+
+// Names of the SC_xxx syscall kinds
+static const char *Scnames[SC_MAX] = {
+    "in", "out", "splice", "seek",
+};
+
+static void print_json(FILE *fp, Acctg *g, Args *a, Perf *pf);
+static void print_perf(FILE *fp, Acctg *g, Perf *pf);
+static void json_str(FILE *fp, const char *s);
+static void print_hist(FILE *fp, Acctg *g);
+static void print_bottleneck(FILE *fp, Acctg *g, Args *a);
+static void print_syscalls(FILE *fp, Acctg *g);
+static void print_wiped(FILE *fp, Acctg *g);
+static int  split_time(double pct[], Acctg *g, Args *a);
+static uint64_t user_us(void);
+static int  done(Acctg *g, Args *a, int rc);
+
 int
 main(int argc, char * const *argv)
 {
@@ -79,19 +114,122 @@ main(int argc, char * const *argv)
     memset(&g, 0, sizeof g);
     memset(&a, 0, sizeof a);
 
+    uint64_t t0 = timenow();
+
     if (Parse_args(&a, opt.argv_count, opt.argv_inputs) < 0) {
         return 1;
     }
 
+    if (a.mode == MODE_SCAN)   g.scan = Scan_new(&a);
+    if (a.mode == MODE_BURNIN || (a.conv & CONV_NOERROR)) g.bad = Bad_new();
+
+    if (opt.explain) {
+        switch (a.mode) {
+            case MODE_WIPE:   Wipe_explain(stdout, &a);   break;
+            case MODE_BURNIN: Burnin_explain(stdout, &a); break;
+            default:          Engine_explain(stdout, &a); break;
+        }
+        Args_close(&a);
+        return done(&g, &a, 0);
+    }
+
+    // The periodic status has latency percentiles
+    g.timing = opt.histogram || a.status_intv > 0;
+
+    if (strlen(a.trace) > 0) {
+        int x = Trace_init(a.trace_size);
+        if (x < 0) error(1, -x, "can't setup trace");
+
+        g.timing = g.tracing = 1;
+    }
+
+
+    uint64_t u0 = 0;
+
+    if (a.status & ST_BOTTLENECK) {
+        g.timing = g.pipewait = 1;
+        u0 = user_us();
+    }
+
+    // Counters must be opened before any thread is created.
+    if (a.status & ST_PERF) Perf_start();
 
     uint64_t st = timenow();
 
-    Copy(&g, &a);
+    int r = Reporter_start(&g, &a);
+    if (r < 0) error(1, -r, "can't start progress reporter");
+
+    PROBE2(copy__start, a.insize, a.iosize);
+
+    // Exit status; a burnin that found bad sectors fails and so
+    // does a copy that had to zero fill some (as dd does) or a scan
+    // that hit read errors.
+    int rc = 0;
+
+    switch (a.mode) {
+        case MODE_WIPE:   Wipe(&g, &a);                 break;
+        case MODE_BURNIN: rc = Burnin(&g, &a) < 0;      break;
+        default:          Copy(&g, &a);                 break;
+    }
+
+    // Sectors are those of the device we had trouble with.
+    uint64_t lbs = a.mode == MODE_BURNIN ? a.odev.lbs : a.inputs[0].dev.lbs;
+    if (lbs == 0) lbs = 512;
+
+    if (g.bad && a.mode != MODE_BURNIN) {
+        Bad_sort(g.bad);
+        rc = g.bad->n > 0;
+    }
+
+    if (g.scan) {
+        uint32_t slow, bad;
+
+        Scan_count(g.scan, &slow, &bad);
+        rc = bad > 0;
+    }
+
+    Reporter_stop(1);
+
+    uint64_t t1 = timenow();
+
+    if (a.status & ST_BOTTLENECK) g.user_us = user_us() - u0;
+
+    PROBE2(copy__end, g.nwr, (t1 - st) / 1000);
+
+    Args_close(&a);
+
+    uint64_t t2 = timenow();
+
+    Perf pf;
+
+    if (a.status & ST_PERF) Perf_stop(&pf);
+
+    if (g.tracing) {
+        int x = Trace_dump(a.trace);
+        if (x < 0) error(0, -x, "can't write trace to %s", a.trace);
+    }
+
+    g.open_us    = (st - t0) / 1000;
+    g.copy_us    = (t1 - st) / 1000;
+    g.flush_us   = (t2 - t1) / 1000;
+    g.elapsed_us = (t2 - st) / 1000;
+
+    if (g.bad && strlen(a.badmap) > 0) {
+        int x = Bad_write(g.bad, a.badmap, lbs);
+        if (x < 0) error(0, -x, "can't write bad ranges to %s", a.badmap);
+    }
+
+    if (g.scan && strlen(a.heatmap) > 0) {
+        int x = Scan_csv(g.scan, a.heatmap);
+        if (x < 0) error(0, -x, "can't write heatmap to %s", a.heatmap);
+    }
 
-    if (a.ifd > 0) close(a.ifd);
-    if (a.ofd > 0) close(a.ofd);
+    if (a.status & ST_JSON) {
+        print_json(stderr, &g, &a, (a.status & ST_PERF) ? &pf : 0);
+        return done(&g, &a, rc);
+    }
 
-    g.elapsed_us = (timenow() - st) / 1000;
+    if (opt.histogram) print_hist(stderr, &g);
 
 #define d(x)  ((double)(x))
     double   wrspeed = d(g.nwr) / d(g.elapsed_us);
@@ -106,9 +244,368 @@ main(int argc, char * const *argv)
     double secs  = d(g.elapsed_us)/1.0e6;
 
     // final results - we always print em.
-    fprintf(stderr, "%s (%" PRIu64 " bytes) copied in %4.6f secs (%4.2f MB/s)\n",
-                sz, g.nwr, secs, wrspeed);
-    return 0;
+    fprintf(stderr, "%s (%" PRIu64 " bytes) %s in %4.6f secs (%4.2f MB/s)\n",
+                sz, g.nwr, a.mode == MODE_WIPE   ? "wiped" :
+                           a.mode == MODE_SCAN   ? "scanned" :
+                           a.mode == MODE_BURNIN ? "written and verified" : "copied", secs, wrspeed);
+
+    if (a.mode == MODE_WIPE)   print_wiped(stderr, &g);
+    if (a.mode == MODE_SCAN)   Scan_print(stderr, g.scan);
+    if (a.mode == MODE_BURNIN || (g.bad && g.bad->n > 0)) Bad_print(stderr, g.bad, lbs);
+
+    if (g.elided > 0 || g.discarded > 0) {
+        char el[64], ds[64];
+
+        humanize_size(el, sizeof el, g.elided);
+        humanize_size(ds, sizeof ds, g.discarded);
+        fprintf(stderr, "%s of zeros not written, %s discarded\n", el, ds);
+    }
+
+    if (g.sc.waits > 0)
+        fprintf(stderr, "waited %4.6f secs in %" PRIu64 " polls for nonblocking I/O\n",
+                    g.sc.wait_ns / 1.0e9, g.sc.waits);
+
+    if (a.status & ST_PERF) print_perf(stderr, &g, &pf);
+    if (a.status & ST_BOTTLENECK) print_bottleneck(stderr, &g, &a);
+    if (a.status & ST_SYSCALLS) print_syscalls(stderr, &g);
+    return done(&g, &a, rc);
+}
+
+
+/*
+ * Free the maps of the scan and burnin modes and the args; return
+ * 'rc'.
+ */
+static int
+done(Acctg *g, Args *a, int rc)
+{
+    if (g->scan) Scan_free(g->scan);
+    if (g->bad)  Bad_free(g->bad);
+    Args_free(a);
+
+    g->scan = 0;
+    g->bad  = 0;
+    return rc;
+}
+
+
+/*
+ * Print the final stats as a single JSON record.
+ */
+static void
+print_json(FILE *fp, Acctg *g, Args *a, Perf *pf)
+{
+    int i;
+
+    fprintf(fp, "{\"inputs\": [");
+    for (i = 0; i < a->ninputs; i++) {
+        if (i > 0) fputs(", ", fp);
+        json_str(fp, a->inputs[i].name);
+    }
+    fprintf(fp, "], \"output\": ");
+    json_str(fp, a->outfile);
+
+    fprintf(fp, ", \"engine\": ");
+    json_str(fp, g->engine ? g->engine : "none");
+
+    fprintf(fp, ", \"iosize\": %" PRIu64 ", \"bytes_read\": %" PRIu64 ""
+                ", \"bytes_written\": %" PRIu64 ", \"bytes_elided\": %" PRIu64 ""
+                ", \"bytes_discarded\": %" PRIu64 ""
+                ", \"syscalls\": %" PRIu64 ", \"peak_buffer_bytes\": %" PRIu64 ""
+                ", \"io_waits\": %" PRIu64 ", \"io_wait_us\": %" PRIu64 "",
+                g->iosize, g->nrd, g->nwr, g->elided, g->discarded, g->nsyscalls, g->bufmem,
+                g->sc.waits, g->sc.wait_ns / 1000);
+
+    if (a->mode == MODE_WIPE) {
+        const char *sep = "";
+
+        fprintf(fp, ", \"wiped\": {");
+        for (i = 0; i < WIPE_MAX; i++) {
+            if (g->wiped[i] == 0) continue;
+
+            fprintf(fp, "%s\"%s\": %" PRIu64 "", sep, Wipenames[i], g->wiped[i]);
+            sep = ", ";
+        }
+        fputc('}', fp);
+    }
+
+    if (a->mode == MODE_SCAN) {
+        uint32_t slow, bad;
+
+        Scan_count(g->scan, &slow, &bad);
+        fprintf(fp, ", \"scan\": {\"regions\": %u, \"region_bytes\": %" PRIu64 ""
+                    ", \"slow\": %u, \"errors\": %u}",
+                    g->scan->n, g->scan->rsize, slow, bad);
+    }
+
+    if (g->bad) {
+        fprintf(fp, ", \"bad\": {\"ranges\": %u", g->bad->n);
+        for (i = 0; i < BAD_MAX; i++)
+            fprintf(fp, ", \"%s_bytes\": %" PRIu64 "", Badnames[i], g->bad->bytes[i]);
+        fputc('}', fp);
+    }
+
+    fprintf(fp, ", \"elapsed_us\": {\"open\": %" PRIu64 ", \"copy\": %" PRIu64 ""
+                ", \"flush\": %" PRIu64 ", \"total\": %" PRIu64 "}",
+                g->open_us, g->copy_us, g->flush_us, g->open_us + g->elapsed_us);
+
+    if (g->timing) {
+        const char *sep = "";
+
+        fprintf(fp, ", \"latency_ns\": {");
+        for (i = 0; i < LAT_MAX; i++) {
+            Hist *h = &g->lat[i];
+
+            if (h->count == 0) continue;
+
+            fprintf(fp, "%s\"%s\": {\"count\": %" PRIu64 ", \"p50\": %" PRIu64 ""
+                        ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64 ", \"p99.9\": %" PRIu64 ""
+                        ", \"max\": %" PRIu64 "}",
+                        sep, Evnames[i], h->count, Hist_pct(h, 50.0), Hist_pct(h, 90.0),
+                        Hist_pct(h, 99.0), Hist_pct(h, 99.9), h->max);
+            sep = ", ";
+        }
+        fputc('}', fp);
+    }
+
+    if (pf) {
+#define _na(x)  ((x) == PERF_NA ? -1 : (int64_t)(x))
+        fprintf(fp, ", \"perf\": {\"cycles\": %" PRId64 ", \"instructions\": %" PRId64 ""
+                    ", \"context_switches\": %" PRIu64 ", \"page_faults\": %" PRIu64 ""
+                    ", \"cpu_migrations\": %" PRId64 ", \"user_us\": %" PRIu64 ""
+                    ", \"sys_us\": %" PRIu64 ", \"max_rss_bytes\": %" PRIu64 ""
+                    ", \"user_only\": %s}",
+                    _na(pf->cycles), _na(pf->instr), pf->ctxsw, pf->faults,
+                    _na(pf->migrations), pf->utime_us, pf->stime_us, pf->maxrss,
+                    pf->user_only ? "true" : "false");
+#undef _na
+    }
+
+    if (a->status & ST_BOTTLENECK) {
+        double pct[TS_MAX];
+        int v = split_time(pct, g, a);
+
+        fprintf(fp, ", \"time_split_pct\": {");
+        for (i = 0; i < TS_MAX; i++)
+            fprintf(fp, "%s\"%s\": %.1f", i > 0 ? ", " : "", Tsnames[i], pct[i]);
+        fprintf(fp, "}, \"verdict\": \"%s-bound\"", Tsnames[v]);
+    }
+
+    if (a->status & ST_SYSCALLS) {
+        const char *sep = "";
+
+        fprintf(fp, ", \"syscalls_by_kind\": {");
+        for (i = 0; i < SC_MAX; i++) {
+            if (g->sc.calls[i] == 0) continue;
+
+            fprintf(fp, "%s\"%s\": {\"calls\": %" PRIu64 ", \"bytes\": %" PRIu64 ""
+                        ", \"short\": %" PRIu64 "}",
+                        sep, Scnames[i], g->sc.calls[i], g->sc.bytes[i], g->sc.shorts[i]);
+            sep = ", ";
+        }
+        fputc('}', fp);
+    }
+
+    double bps = g->elapsed_us > 0 ? (1.0e6 * g->nwr) / g->elapsed_us : 0.0;
+
+    fprintf(fp, ", \"bytes_per_sec\": %.0f, \"digest\": null}\n", bps);
+}
+
+
+/*
+ * Print the bytes filled by each wipe tier that did any, and what
+ * was only trimmed.
+ */
+static void
+print_wiped(FILE *fp, Acctg *g)
+{
+    const char *sep = "";
+    int i;
+
+    fprintf(fp, "wiped by:");
+    for (i = 0; i < WIPE_MAX; i++) {
+        char sz[64];
+
+        if (g->wiped[i] == 0) continue;
+
+        humanize_size(sz, sizeof sz, g->wiped[i]);
+        fprintf(fp, "%s %s %s", sep, Wipenames[i], sz);
+        sep = ",";
+    }
+
+    // A discard without the promise of zeros is just a trim.
+    if (g->discarded > 0) {
+        char sz[64];
+
+        humanize_size(sz, sizeof sz, g->discarded);
+        fprintf(fp, " (trimmed %s first)", sz);
+    }
+    fputc('\n', fp);
+}
+
+
+/*
+ * Print the CPU cost of the copy: per byte for the hardware
+ * counters and per GiB for the rest. Counters we couldn't open are
+ * left out.
+ */
+static void
+print_perf(FILE *fp, Acctg *g, Perf *pf)
+{
+    double b   = g->nwr > 0 ? (double)g->nwr : 1.0;
+    double gib = b / (1024.0 * 1024.0 * 1024.0);
+    double cpu = (double)(pf->utime_us + pf->stime_us);
+    char rss[64];
+
+    humanize_size(rss, sizeof rss, pf->maxrss);
+
+    if (pf->hw) {
+        fprintf(fp, "perf: %.3f cycles/byte, ", pf->cycles / b);
+        if (pf->instr != PERF_NA) fprintf(fp, "%.3f instr/byte", pf->instr / b);
+        else                      fprintf(fp, "n/a instr/byte");
+        if (pf->instr != PERF_NA && pf->cycles > 0)
+            fprintf(fp, " (IPC %.2f)", (double)pf->instr / pf->cycles);
+        fprintf(fp, "%s\n", pf->user_only ? " [user only]" : "");
+    } else {
+        fprintf(fp, "perf: no hardware counters\n");
+    }
+
+    fprintf(fp, "perf: %.1f ctx-switches/GiB, %.1f page-faults/GiB",
+                pf->ctxsw / gib, pf->faults / gib);
+    if (pf->migrations != PERF_NA)
+        fprintf(fp, ", %.1f cpu-migrations/GiB", pf->migrations / gib);
+    fputc('\n', fp);
+
+    fprintf(fp, "perf: user %.3f s, sys %.3f s (%.2f cores), max RSS %s\n",
+                pf->utime_us / 1.0e6, pf->stime_us / 1.0e6,
+                g->elapsed_us > 0 ? cpu / g->elapsed_us : 0.0, rss);
+}
+
+
+/*
+ * Fill pct[] and return the largest of the TS_SOURCE..TS_CPU
+ * shares. Queue waits are a symptom of the other two threads'
+ * imbalance and never the verdict.
+ */
+static int
+split_time(double pct[], Acctg *g, Args *a)
+{
+    uint64_t *b = g->busy_ns;
+    double wall = g->copy_us > 0 ? 1000.0 * g->copy_us : 1.0;
+    int i, v = TS_SOURCE;
+
+    // A direct splice is billed to the side that isn't a pipe;
+    // the pipe waits have already been taken out of it.
+    uint64_t splice = b[LAT_SPLICE];
+
+    pct[TS_SOURCE] = b[LAT_RD] + (a->opipe ? splice : 0);
+    pct[TS_SINK]   = b[LAT_WR] + (a->opipe ? 0 : splice);
+    pct[TS_PIPE]   = b[EV_PIPE_WAIT];
+    pct[TS_CPU]    = 1000.0 * g->user_us;
+    pct[TS_QUEUE]  = b[EV_FREE_DEQ] + b[EV_IO_ENQ] + b[EV_IO_DEQ] + b[EV_FREE_ENQ];
+
+    for (i = 0; i < TS_MAX; i++) {
+        pct[i] = 100.0 * pct[i] / wall;
+        if (i < TS_QUEUE && pct[i] > pct[v]) v = i;
+    }
+    return v;
+}
+
+
+/*
+ * Print the time split and the verdict for status=bottleneck.
+ */
+static void
+print_bottleneck(FILE *fp, Acctg *g, Args *a)
+{
+    double pct[TS_MAX];
+    int i, v = split_time(pct, g, a);
+
+    fprintf(fp, "time:");
+    for (i = 0; i < TS_MAX; i++)
+        fprintf(fp, " %s %.1f%%", Tsnames[i], pct[i]);
+    fprintf(fp, "\nverdict: %s-bound %.0f%%\n", Tsnames[v], pct[v]);
+}
+
+
+/*
+ * Print the calls per GiB copied, the mean transfer size and the
+ * number of short transfers for each kind of syscall. A mean well
+ * below iosize means the pipe or the producer is limiting the
+ * transfer size.
+ */
+static void
+print_syscalls(FILE *fp, Acctg *g)
+{
+    double gib = g->nwr > 0 ? g->nwr / (1024.0 * 1024.0 * 1024.0) : 1.0;
+    int i;
+
+    for (i = 0; i < SC_MAX; i++) {
+        uint64_t n = g->sc.calls[i];
+
+        if (n == 0) continue;
+
+        if (i == SC_SEEK) {
+            fprintf(fp, "syscalls: %-6s %10" PRIu64 " calls\n", Scnames[i], n);
+            continue;
+        }
+
+        fprintf(fp, "syscalls: %-6s %10" PRIu64 " calls, %.1f/GiB, mean %" PRIu64 " bytes/call"
+                    ", %" PRIu64 " short\n",
+                    Scnames[i], n, n / gib, g->sc.bytes[i] / n, g->sc.shorts[i]);
+    }
+}
+
+
+/*
+ * Return the user CPU time of the process so far.
+ */
+static uint64_t
+user_us(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t)ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec;
+}
+
+
+/*
+ * Print the latency percentiles of each kind of I/O we did.
+ */
+static void
+print_hist(FILE *fp, Acctg *g)
+{
+    int i;
+
+    for (i = 0; i < LAT_MAX; i++) {
+        Hist *h = &g->lat[i];
+
+        if (h->count > 0) Hist_print(fp, Evnames[i], h);
+    }
+}
+
+
+/*
+ * Print 's' as a quoted JSON string.
+ */
+static void
+json_str(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = *s;
+
+        if (c == '"' || c == '\\') {
+            fputc('\\', fp);
+            fputc(c, fp);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
 }
 
 
@@ -116,25 +613,53 @@ main(int argc, char * const *argv)
 const char*
 opt_usage()
 {
-    static char msg[1024];
+    static char msg[4096];
     snprintf(msg, sizeof msg, "Usage: %s [options] [arguments]\n"
             "\n"
             "Arguments:\n"
-            "    if=FILE   Read input from FILE [STDIN]\n"
+            "    if=FILE   Read input from FILE; a comma separated list of files\n"
+            "              is read back to back as one input [STDIN]\n"
+            "    if=gen:G  Generate the input (needs count=); G is one of:\n"
+            "              zero, pattern, random[:seed], entropy=N%%[:seed]\n"
             "    of=FILE   Write output to FILE [STDOUT]\n"
+            "    of=null:  Discard the output\n"
             "    bs=N      Use N as the input/output blocksize [512]\n"
             "    count=N   Copy N bytes from infile to outfile [Till EOF]\n"
             "    skip=N    Skip first N bytes of the input [0]\n"
             "    seek=N    Seek to offset N before first write to output [0]\n"
             "    iosize=N  Do I/O in chunks of N bytes [64kB]\n"
+            "    engine=E  Copy with E: auto, splice, posix, uring, cfr, mmap or shard [auto]\n"
+            "    rate=N    Limit the copy to N bytes/sec [unlimited]\n"
+            "    burst=N   Allow bursts of N bytes above rate [rate/10]\n"
+            "    status=S  Final statistics; S is a list of: json, perf, bottleneck, syscalls []\n"
+            "    status_interval=T  Print stats every T (e.g., 10s, 2m) []\n"
+            "    metrics=FILE       Write Prometheus metrics to FILE every metrics_interval []\n"
+            "    metrics_interval=T Interval for metrics= [10s]\n"
+            "    metrics_shm=FILE   Publish live stats in a mmap'd struct in FILE []\n"
+            "    trace=FILE         Write a Chrome trace of I/O and queue events to FILE []\n"
+            "    trace_size=N       Keep at most N trace events per thread [256k]\n"
 #ifdef O_DIRECT
             "    iflag=IF  One or more flags for input file I/O (nonblock,direct) []\n"
-            "    oflag=OF  One or more flags for output file I/O (nonblock,direct,excl,sync,trunc,creat) []\n"
+            "    oflag=OF  One or more flags for output file I/O (nonblock,direct,excl,sync,trunc,creat,discard) []\n"
 #else
             "    iflag=IF  One or more input flags for I/O (nonblock) []\n"
-            "    oflag=OF  One or more flags for output file I/O (nonblock,excl,sync,trunc,creat) []\n"
+            "    oflag=OF  One or more flags for output file I/O (nonblock,excl,sync,trunc,creat,discard) []\n"
 #endif
+            "    conv=noerror,sync  Zero fill unreadable sectors and go on; failed reads are\n"
+            "              split in halves down to one sector\n"
+            "    badmap=FILE  conv=noerror: write the unreadable ranges as CSV to FILE []\n"
 
+            "\n"
+            "Modes (a bare word among the arguments):\n"
+            "    wipe      Fill seek=..count= of the output (all of it without count=)\n"
+            "              with if=gen:G [gen:zero]; offloaded to the device when it can\n"
+            "    scan      Read the input (O_DIRECT for devices) to of=null: and map\n"
+            "              the read latency and errors of each region\n"
+            "    heatmap=FILE  scan: write the map as CSV to FILE []\n"
+            "    burnin    Write if=gen:G [gen:random] over the output like wipe, read it\n"
+            "              back and compare; exits 1 if any sector is bad\n"
+            "\n"
+            "Sending SIGUSR1 prints the stats so far without interrupting the copy.\n"
             "\n"
             "Note: The flags direct, excl, sync, trunc, creat also have their corresponding\n"
             "      negative version prefixed with 'no' (e.g., nodirect, notrunc, nocreat etc.)\n"
@@ -26,34 +26,407 @@ extern "C" {
 #include <stdarg.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #include "args.h"
+#include "hist.h"
+#include "utils/utils.h"
+
+// Latency histograms we keep; one per kind of I/O syscall.
+#define LAT_RD          0   // read(2) or input half of a splice
+#define LAT_WR          1   // write(2) or output half of a splice
+#define LAT_SPLICE      2   // splice(2) directly from input to output
+#define LAT_MAX         3
+
+// Other timed events; these are traced but have no histogram.
+#define EV_FREE_DEQ     3   // reader waiting for a free buffer
+#define EV_IO_ENQ       4   // reader waiting to queue a full buffer
+#define EV_IO_DEQ       5   // writer waiting for a full buffer
+#define EV_FREE_ENQ     6   // writer returning a buffer
+#define EV_PIPE_WAIT    7   // waiting for a pipe to fill or drain
+#define EV_MAX          8
+
+// Names of the LAT_xxx and EV_xxx events
+extern const char *Evnames[EV_MAX];
+
+// Kinds of I/O syscalls we count
+#define SC_IN           0   // read(2) or input half of a splice
+#define SC_OUT          1   // write(2) or output half of a splice
+#define SC_SPLICE       2   // splice(2) directly from input to output
+#define SC_SEEK         3   // lseek(2) for skip=
+#define SC_MAX          4
+
+// Wipe tiers; the offloads before WIPE_WRITE only fill zeros.
+#define WIPE_SECDISCARD 0   // BLKSECDISCARD; if the device promises zeros
+#define WIPE_DISCARD    1   // BLKDISCARD; if the device promises zeros
+#define WIPE_ZEROOUT    2   // BLKZEROOUT on a device that offloads it
+#define WIPE_ZERORANGE  3   // FALLOC_FL_ZERO_RANGE on a file
+#define WIPE_WRITE      4   // write(2) a pre-built buffer
+#define WIPE_MAX        5
+
+struct Syscnt {
+    uint64_t calls[SC_MAX];
+    uint64_t bytes[SC_MAX];
+    uint64_t shorts[SC_MAX];    // transfers that moved less than asked
+    uint64_t waits;             // polls of a nonblocking fd after EAGAIN
+    uint64_t wait_ns;           // .. and the time blocked in them
+};
+typedef struct Syscnt Syscnt;
 
 struct Acctg {
     uint64_t nrd,
              nwr;
 
     uint64_t elapsed_us;
+
+    // time spent in each phase of the run
+    uint64_t open_us,       // parsing args and opening files
+             copy_us,       // moving data
+             flush_us;      // closing (and flushing) the files
+
+    const char *engine;     // name of the engine that did the copy
+    uint64_t    wiped[WIPE_MAX]; // bytes filled by each wipe tier
+    uint64_t    iosize;     // effective I/O size used by the engine
+
+    uint64_t nsyscalls;     // I/O syscalls issued by the engines
+    Syscnt   sc;            // .. and broken down by kind
+    uint64_t elided;        // bytes we didn't have to write
+    uint64_t discarded;     // bytes trimmed by oflag=discard
+    uint64_t bufmem;        // peak memory used for I/O buffers
+
+    // Writer queue (posix engine); nenq and ndeq are each updated
+    // by one thread.
+    uint64_t qsize,
+             nenq,
+             ndeq;
+
+    uint64_t nerrors;       // I/O errors
+    struct Scanmap *scan;   // scan mode: read latency per region
+    struct Badmap  *bad;    // burnin mode and conv=noerror: ranges that failed
+    uint64_t user_us;       // user CPU time of the copy (status=bottleneck)
+
+    // When set, every I/O syscall in the engines is timed.
+    int  timing;
+    int  tracing;       // timed events also go to the trace
+    int  pipewait;      // splice engine polls pipes (EV_PIPE_WAIT)
+    Hist lat[LAT_MAX];
+
+    // Total time spent in each timed event; each is updated by one
+    // thread.
+    uint64_t busy_ns[EV_MAX];
 };
 typedef struct Acctg Acctg;
 
+/*
+ * The counters in Acctg are updated by one thread and read
+ * concurrently by the reporter thread; relaxed atomics are enough
+ * (and compile to plain loads/stores on most archs).
+ */
+#define Acct_get(p)     __atomic_load_n(p, __ATOMIC_RELAXED)
+#define Acct_add(p, n)  __atomic_store_n(p, Acct_get(p) + (n), __ATOMIC_RELAXED)
+
+/*
+ * Per-thread ring buffers of timed events for trace=FILE; dumped as
+ * Chrome trace JSON by Trace_dump() after all threads are done.
+ */
+int  Trace_init(uint64_t nevents);
+void Trace_thread(const char *name);
+void Trace_add(uint32_t ev, uint64_t t0, uint64_t t1);
+int  Trace_dump(const char *fn);
+
+/*
+ * Run 'stmt' (an I/O syscall or a queue op) and record it as event
+ * 'ev' when timing is enabled. When disabled, this costs a single
+ * predictable branch.
+ */
+#define TIMED(g, ev, stmt)  do { \
+                                if (unlikely((g)->timing)) { \
+                                    uint64_t t0_ = timenow(); \
+                                    stmt; \
+                                    __timed(g, ev, t0_, timenow()); \
+                                } else { \
+                                    stmt; \
+                                } \
+                            } while (0)
+
+static inline void
+__timed(Acctg *g, uint32_t ev, uint64_t t0, uint64_t t1)
+{
+    if (ev < LAT_MAX) Hist_add(&g->lat[ev], t1 - t0);
+    Acct_add(&g->busy_ns[ev], t1 - t0);
+    if (g->tracing)   Trace_add(ev, t0, t1);
+}
+
+/*
+ * Each thread that does I/O counts its syscalls in a thread local
+ * counter and folds it into Acctg when it is done. A transfer is
+ * short if it moved some, but not all, of 'want' bytes.
+ */
+extern __thread Syscnt Sc;
+
+#define Sc_count(k, want, got)  do { \
+                                    Sc.calls[k]++; \
+                                    if ((got) > 0) { \
+                                        Sc.bytes[k] += (got); \
+                                        if ((size_t)(got) < (size_t)(want)) Sc.shorts[k]++; \
+                                    } \
+                                } while (0)
+
+void Acct_fold(Acctg *g);
+
+/*
+ * Progress reporting runs in its own thread; the engines only
+ * update the counters in Acctg. Engines must call Reporter_stop(0)
+ * before bailing out on fatal errors.
+ */
+int  Reporter_start(Acctg *g, Args *a);
+void Reporter_stop(int ok);
+
+/*
+ * Exporters for metrics= and metrics_shm=; driven by the reporter
+ * thread.
+ */
+int  Metrics_open(Acctg *g, Args *a);
+void Metrics_update(uint64_t now, int done);
+void Metrics_close(void);
+
+
+/*
+ * Self-profiling for status=perf. Perf_start() must be called
+ * before any threads are created so that the counters are inherited
+ * by every thread of the copy. Counters that can't be opened are
+ * marked with PERF_NA.
+ */
+#define PERF_NA     (~(uint64_t)0)
+
+struct Perf {
+    uint64_t cycles;
+    uint64_t instr;
+    uint64_t ctxsw;
+    uint64_t faults;
+    uint64_t migrations;
+
+    uint64_t utime_us;
+    uint64_t stime_us;
+    uint64_t maxrss;    // peak RSS in bytes
+
+    int      hw;        // 1 if hardware counters are available
+    int      user_only; // 1 if kernel time is excluded (perf_event_paranoid)
+};
+typedef struct Perf Perf;
+
+void Perf_start(void);
+void Perf_stop(Perf *p);
+
+
+/*
+ * Token bucket for rate= limiting.
+ */
+struct Ratelimit {
+    uint64_t rate;      // bytes/sec; 0 => unlimited
+    uint64_t burst;     // depth of the bucket in bytes
+    int64_t  tokens;    // can go negative (debt)
+    uint64_t last;      // time of last refill (ns)
+};
+typedef struct Ratelimit Ratelimit;
+
+void Ratelimit_init(Ratelimit *rl, uint64_t rate, uint64_t burst);
+void Ratelimit_charge(Ratelimit *rl, uint64_t n);
+
+// Cheap test to be used in the copy loops
+#define Ratelimit(rl, n)    do { \
+                                if ((rl)->rate > 0) Ratelimit_charge(rl, n); \
+                            } while (0)
 
 /*
  * Perform a copy operation for arguments in 'a' and write stats
- * into 'g'.
+ * into 'g'. Copy() picks one of the engines below (engine.c).
  */
 extern int Copy(Acctg *g, Args *a);
 
+/*
+ * Print the engine Copy() would use for 'a', and why, without
+ * copying anything.
+ */
+extern void Engine_explain(FILE *fp, Args *a);
+
+// The engines; not every engine exists on every OS.
+extern int Copy_splice(Acctg *g, Args *a);  // copy_linux.c
+extern int Copy_cfr(Acctg *g, Args *a);     // copy_cfr.c
+extern int Copy_posix(Acctg *g, Args *a);   // copy_posix.c
+extern int Copy_mmap(Acctg *g, Args *a);    // copy_mmap.c
+extern int Copy_shard(Acctg *g, Args *a);   // copy_shard.c
+extern int Copy_uring(Acctg *g, Args *a);   // copy_uring.c
+
+// Return true if the kernel can run the uring engine.
+extern int Uring_ok(void);
+
+// Effective I/O size of the engines that don't use a->iosize as is.
+extern uint64_t Cfr_iosize(Args *a);
+extern uint64_t Mmap_iosize(Args *a);
+
+/*
+ * oflag=discard: trim the part of the output we are about to
+ * overwrite and set a->zfill. Return the bytes trimmed or -errno.
+ * When the size of the copy isn't known, nothing is trimmed here;
+ * Discard_ahead() trims the 'n' bytes at 'off' as they are written.
+ */
+extern int64_t Discard_output(Args *a);
+extern int64_t Discard_ahead(Args *a, uint64_t off, size_t n);
+
+/*
+ * Get the 'n' zero bytes at output offset 'off' there without
+ * writing them, per a->zfill. Return 1 if done, 0 if the caller must
+ * write them.
+ */
+extern int Zero_elide(Args *a, uint64_t off, size_t n);
+
+/*
+ * The wipe mode (wipe.c): fill the output range per 'a' trying the
+ * WIPE_xxx tiers in order. Wipe_explain() prints the tiers it would
+ * try.
+ */
+extern int  Wipe(Acctg *g, Args *a);
+extern void Wipe_explain(FILE *fp, Args *a);
+
+// Names of the WIPE_xxx tiers
+extern const char *Wipenames[WIPE_MAX];
+
+/*
+ * The scan mode (scan.c): a copy to of=null: by the shard engine
+ * that records the read latency and errors of each region of the
+ * input.
+ */
+struct Scanregion {
+    uint64_t reads,
+             errors,
+             sum_ns,
+             max_ns;
+};
+typedef struct Scanregion Scanregion;
+
+struct Scanmap {
+    uint64_t base;      // input offset of the first region (skip=)
+    uint64_t len;       // bytes scanned
+    uint64_t rsize;     // bytes per region; a multiple of iosize
+    uint64_t lbs;       // sector size for the LBAs we print
+    uint32_t n;
+
+    Scanregion *r;
+};
+typedef struct Scanmap Scanmap;
+
+extern Scanmap *Scan_new(Args *a);
+extern void     Scan_free(Scanmap *m);
+extern void     Scan_add(Scanmap *m, uint64_t off, uint64_t ns, int err);
+extern void     Scan_count(const Scanmap *m, uint32_t *slow, uint32_t *bad);
+extern void     Scan_print(FILE *fp, const Scanmap *m);
+extern int      Scan_csv(const Scanmap *m, const char *fn);
+
+/*
+ * The burnin mode (burnin.c): write the generator over the output
+ * range, read it back and compare it with the generator; failures go
+ * to g->bad. Return 0 if all of it verified, else -EIO.
+ */
+extern int  Burnin(Acctg *g, Args *a);
+extern void Burnin_explain(FILE *fp, Args *a);
+
+/*
+ * Ranges of a device that failed (badmap.c); offsets in bytes.
+ */
+#define BAD_READ        0   // read error
+#define BAD_WRITE       1   // write error
+#define BAD_DATA        2   // read back something else
+#define BAD_MAX         3
+
+// Names of the BAD_xxx kinds
+extern const char *Badnames[BAD_MAX];
+
+struct Badrange {
+    uint64_t off,
+             len;
+    int      kind;      // BAD_xxx
+    int      err;       // errno; 0 for BAD_DATA
+};
+typedef struct Badrange Badrange;
+
+struct Badmap {
+    Badrange *v;
+    uint32_t  n,
+              cap;
+    uint64_t  bytes[BAD_MAX];
+
+    pthread_mutex_t lock;
+};
+typedef struct Badmap Badmap;
+
+extern Badmap *Bad_new(void);
+extern void    Bad_free(Badmap *m);
+extern void    Bad_add(Badmap *m, int kind, uint64_t off, uint64_t len, int err);
+extern void    Bad_sort(Badmap *m);
+extern void    Bad_print(FILE *fp, const Badmap *m, uint64_t lbs);
+extern int     Bad_write(const Badmap *m, const char *fn, uint64_t lbs);
+
+/*
+ * conv=noerror: read 'n' bytes at 'off' of 'fd' into 'buf' after a
+ * read of them failed; split the range in halves down to sectors of
+ * 'lbs' bytes and zero fill (and map) the sectors that still fail.
+ * Return the bytes read; less than 'n' only at EOF.
+ */
+extern size_t  Read_rescue(Badmap *m, int fd, uint8_t *buf, uint64_t off, size_t n, uint32_t lbs);
+
+/*
+ * Have the OS fill 'len' bytes at output offset 'off' per 'tier'
+ * (not WIPE_WRITE). Return 0 on success, -errno on failure.
+ */
+extern int Wipe_offload(Args *a, int tier, uint64_t off, uint64_t len);
+
+// Return true if all 'n' bytes at 'p' are zero
+extern int iszero(const void *p, size_t n);
+
+/*
+ * Write 'n' bytes at 'buf' to output offset 'off' and elide the zero
+ * runs (of at least ZRUN bytes) per a->zfill. Return the bytes
+ * elided or -errno.
+ */
+#define ZBLK    4096
+#define ZRUN    65536
+extern int64_t Write_sparse(Acctg *t, Args *a, const uint8_t *buf, size_t n, uint64_t off);
+
+/*
+ * Return the size of the next chunk to write at output offset 'ooff'
+ * when at most 'max' bytes fit: the chunk ends on the last multiple
+ * of a->oalign within reach. After an unaligned skip/seek or a short
+ * read, this is one short chunk and then aligned ones.
+ */
+extern uint64_t Chunk_len(Args *a, uint64_t ooff, uint64_t max);
+
 /*
  * Return blocksize of device in 'fd'.
  */
 extern int Blksize(uint64_t *p_size, int fd);
 
+/*
+ * Fill 'd' with the topology of the block device 'fd' or, for other
+ * files, of the device they live on.
+ * Return 0 on success, -errno on failure.
+ */
+extern int Devinfo_get(Devinfo *d, int fd);
+
+/*
+ * Print 'd' as a few indented lines.
+ */
+extern void Devinfo_print(FILE *fp, const Devinfo *d);
+
 
 // -- Internal functions --
 ssize_t fullread(int fd, void *buf, size_t n);
 ssize_t fullwrite(int fd, void *buf, size_t n);
+ssize_t fullread_timed(Acctg *g, int fd, void *buf, size_t n);
+ssize_t fullwrite_timed(Acctg *g, int fd, void *buf, size_t n);
+int     Io_wait(int fd, short events);
 ssize_t skip(int fd, uint64_t n);
+int     skip_input(Args *a, uint64_t n);
 
 extern int Quiet;
 
@@ -0,0 +1,260 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * gen.c - synthetic data source for if=gen:...
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ * o  Random data comes from GEN_LANES independent xorshift128+
+ *    generators stepped in lock-step; each step yields
+ *    8 * GEN_LANES bytes. With -O3, gcc and clang turn the lane
+ *    loop into SIMD code. It is far faster than /dev/urandom and
+ *    doesn't compress or dedup.
+ *
+ * o  The lanes are reseeded at every GEN_BLK block from the seed and
+ *    the block offset; a byte of the stream is a function of the
+ *    seed and its offset alone. So Gen_skip() and Gen_seek() are
+ *    O(1), and the stream is the same whatever the sizes of the
+ *    Gen_fill() calls that produce it.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "gen.h"
+
+#define GEN_SEED        0x5eedf00dcafeULL
+
+static void     rand_fill(Gen *g, uint8_t *p, size_t n);
+static void     rand_seed(Gen *g, uint64_t blk);
+static void     pattern_fill(Gen *g, uint8_t *p, size_t n);
+static uint64_t splitmix64(uint64_t *x);
+
+
+int
+Gen_parse(Gen *g, const char *spec)
+{
+    const char *seed = 0;
+    char *end;
+
+    memset(g, 0, sizeof *g);
+    g->seed = GEN_SEED;
+
+    if (0 == strcmp(spec, "zero")) {
+        g->type = GEN_ZERO;
+    } else if (0 == strcmp(spec, "pattern")) {
+        g->type = GEN_PATTERN;
+    } else if (0 == strncmp(spec, "random", 6) && (spec[6] == 0 || spec[6] == ':')) {
+        g->type    = GEN_RANDOM;
+        g->entropy = 100;
+        if (spec[6] == ':') seed = spec + 7;
+    } else if (0 == strncmp(spec, "entropy=", 8)) {
+        unsigned long v = strtoul(spec + 8, &end, 10);
+
+        if (end == spec + 8 || *end != '%' || v > 100) return -EINVAL;
+
+        g->type    = GEN_RANDOM;
+        g->entropy = v;
+        if (end[1] == ':') {
+            seed = end + 2;
+        } else if (end[1] != 0) {
+            return -EINVAL;
+        }
+    } else {
+        return -EINVAL;
+    }
+
+    if (seed) {
+        g->seed = strtoull(seed, &end, 0);
+        if (end == seed || *end != 0) return -EINVAL;
+    }
+
+    rand_seed(g, 0);
+    return 0;
+}
+
+
+void
+Gen_fill(Gen *g, void *buf, size_t n)
+{
+    uint8_t *p = buf;
+
+    switch (g->type) {
+        case GEN_ZERO:
+            memset(p, 0, n);
+            g->off += n;
+            break;
+
+        case GEN_PATTERN:
+            pattern_fill(g, p, n);
+            break;
+
+        case GEN_RANDOM:
+            if (g->entropy == 100) {
+                rand_fill(g, p, n);
+                g->off += n;
+                break;
+            }
+
+            // The first 'entropy' % of each block is random, the rest
+            // zero.
+            while (n > 0) {
+                size_t bo  = g->off % GEN_BLK;
+                size_t rnd = (GEN_BLK * g->entropy) / 100;
+                size_t m   = GEN_BLK - bo;
+                size_t r   = 0;
+
+                if (m > n) m = n;
+                if (bo < rnd) {
+                    r = rnd - bo;
+                    if (r > m) r = m;
+                }
+
+                rand_fill(g, p, r);
+                memset(p + r, 0, m - r);
+
+                p      += m;
+                n      -= m;
+                g->off += m;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+void
+Gen_skip(Gen *g, uint64_t n)
+{
+    g->off += n;
+}
+
+
+void
+Gen_seek(Gen *g, uint64_t off)
+{
+    g->off = off;
+}
+
+
+/*
+ * Seed the lanes for the block at offset 'blk'.
+ */
+static void
+rand_seed(Gen *g, uint64_t blk)
+{
+    uint64_t y = blk;
+    uint64_t x = g->seed ^ splitmix64(&y);
+    int i;
+
+    for (i = 0; i < GEN_LANES; i++) {
+        g->s0[i] = splitmix64(&x);
+        g->s1[i] = splitmix64(&x);
+    }
+    g->blk  = blk;
+    g->step = 0;
+}
+
+
+/*
+ * One step of every lane; writes 8 * GEN_LANES bytes to 'out'.
+ */
+static inline void
+rand_step(Gen *g, uint64_t *out)
+{
+    int i;
+
+    for (i = 0; i < GEN_LANES; i++) {
+        uint64_t x = g->s0[i];
+        uint64_t y = g->s1[i];
+
+        g->s0[i] = y;
+        x ^= x << 23;
+        g->s1[i] = x ^ y ^ (x >> 17) ^ (y >> 26);
+        out[i]   = g->s1[i] + y;
+    }
+}
+
+
+/*
+ * Fill 'n' random bytes at 'p' for the stream offset g->off; the
+ * caller advances g->off.
+ */
+static void
+rand_fill(Gen *g, uint8_t *p, size_t n)
+{
+    uint64_t off = g->off;
+
+    while (n > 0) {
+        uint64_t blk  = off & ~(uint64_t)(GEN_BLK - 1);
+        uint32_t step = (off % GEN_BLK) / sizeof g->w;
+        size_t   wo   = off % sizeof g->w;
+        size_t   m    = sizeof g->w - wo;
+
+        // reseed unless the lanes are at or just past this step
+        if (blk != g->blk || step + 1 < g->step) rand_seed(g, blk);
+        for (; g->step <= step; g->step++) rand_step(g, g->w);
+
+        if (m > n) m = n;
+        memcpy(p, (uint8_t *)g->w + wo, m);
+
+        p   += m;
+        off += m;
+        n   -= m;
+    }
+}
+
+
+/*
+ * Each aligned 8 byte word holds its own stream offset (host byte
+ * order); no two blocks are ever the same, so it doesn't dedup.
+ */
+static void
+pattern_fill(Gen *g, uint8_t *p, size_t n)
+{
+    uint64_t w;
+
+    // leading and trailing partial words
+    while (n > 0 && ((g->off & 7) || n < 8)) {
+        w = g->off & ~7ULL;
+        *p++ = ((uint8_t *)&w)[g->off & 7];
+        g->off++;
+        n--;
+    }
+
+    for (; n >= 8; n -= 8, p += 8, g->off += 8)
+        memcpy(p, &g->off, 8);
+
+    while (n > 0) {
+        w = g->off & ~7ULL;
+        *p++ = ((uint8_t *)&w)[g->off & 7];
+        g->off++;
+        n--;
+    }
+}
+
+
+static uint64_t
+splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133eb111ULL;
+    return z ^ (z >> 31);
+}
+
+/* EOF */
@@ -0,0 +1,88 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * gen.h - synthetic data source for if=gen:...
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___GEN_H__p8Wq2LrT6xNc0hZs___
+#define ___GEN_H__p8Wq2LrT6xNc0hZs___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define GEN_NONE        0
+#define GEN_ZERO        1   // all zeros
+#define GEN_PATTERN     2   // every 8 bytes hold their own offset
+#define GEN_RANDOM      3   // PRNG; 'entropy' % of each block
+
+// entropy=N% applies to each block of this size; the PRNG is
+// reseeded at each block from the seed and the block's offset.
+#define GEN_BLK         4096
+
+// Independent PRNG lanes; the fill loop is written so that the
+// compiler can vectorize across the lanes.
+#define GEN_LANES       8
+
+struct Gen {
+    int      type;
+    uint32_t entropy;   // percent of each GEN_BLK that is random
+    uint64_t seed;
+    uint64_t off;       // offset of the next byte we generate
+
+    // xorshift128+ state for each lane; seeded for block 'blk' and
+    // about to produce step 'step' of it. 'w' holds the previous
+    // step.
+    uint64_t blk;
+    uint32_t step;
+    uint64_t s0[GEN_LANES];
+    uint64_t s1[GEN_LANES];
+    uint64_t w[GEN_LANES];
+};
+typedef struct Gen Gen;
+
+/*
+ * Parse the spec after "gen:" -- one of zero, pattern,
+ * random[:seed], entropy=N%[:seed]. Return 0 on success, -errno on
+ * failure.
+ */
+int  Gen_parse(Gen *g, const char *spec);
+
+/*
+ * Fill 'buf' with the next 'n' bytes of the stream.
+ */
+void Gen_fill(Gen *g, void *buf, size_t n);
+
+/*
+ * Skip the next 'n' bytes of the stream.
+ */
+void Gen_skip(Gen *g, uint64_t n);
+
+/*
+ * Move the stream to offset 'off'. The bytes at an offset depend
+ * only on the seed and the offset; never on how the stream was
+ * filled or skipped to get there.
+ */
+void Gen_seek(Gen *g, uint64_t off);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___GEN_H__p8Wq2LrT6xNc0hZs___ */
+
+/* EOF */
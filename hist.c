@@ -0,0 +1,112 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * hist.c - log-linear latency histograms
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "hist.h"
+
+static uint64_t bucket_max(uint32_t i);
+static char*    fmt_ns(char *buf, size_t bsiz, uint64_t ns);
+
+
+uint64_t
+Hist_pct(const Hist *h, double pct)
+{
+    uint64_t n = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    uint64_t want,
+             seen = 0;
+    uint32_t i;
+
+    if (n == 0) return 0;
+
+    want = (uint64_t)((pct / 100.0) * n);
+    if (want == 0)   want = 1;
+    if (want > n)    want = n;
+
+    for (i = 0; i < HIST_NBUCKETS; i++) {
+        seen += __atomic_load_n(&h->b[i], __ATOMIC_RELAXED);
+        if (seen >= want) {
+            uint64_t v = bucket_max(i);
+            uint64_t m = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+            return v > m ? m : v;
+        }
+    }
+    return __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+}
+
+
+void
+Hist_print(FILE *fp, const char *name, const Hist *h)
+{
+    char p50[32], p90[32], p99[32], p999[32], max[32];
+
+    fmt_ns(p50,  sizeof p50,  Hist_pct(h, 50.0));
+    fmt_ns(p90,  sizeof p90,  Hist_pct(h, 90.0));
+    fmt_ns(p99,  sizeof p99,  Hist_pct(h, 99.0));
+    fmt_ns(p999, sizeof p999, Hist_pct(h, 99.9));
+    fmt_ns(max,  sizeof max,  __atomic_load_n(&h->max, __ATOMIC_RELAXED));
+
+    fprintf(fp, "%-6s %10" PRIu64 " calls: p50 %s p90 %s p99 %s p99.9 %s max %s\n",
+            name, __atomic_load_n(&h->count, __ATOMIC_RELAXED),
+            p50, p90, p99, p999, max);
+}
+
+
+void
+Hist_merge(Hist *dst, const Hist *src)
+{
+    uint32_t i;
+
+    for (i = 0; i < HIST_NBUCKETS; i++) {
+        if (src->b[i]) __atomic_store_n(&dst->b[i], dst->b[i] + src->b[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&dst->sum,   dst->sum   + src->sum,   __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->count, dst->count + src->count, __ATOMIC_RELAXED);
+    if (src->max > dst->max) __atomic_store_n(&dst->max, src->max, __ATOMIC_RELAXED);
+}
+
+
+// Return the largest value that falls in bucket 'i'
+static uint64_t
+bucket_max(uint32_t i)
+{
+    if (i < HIST_SUB) return i;
+
+    uint32_t k     = i - HIST_SUB;
+    uint32_t shift = (k / (HIST_SUB/2)) + 1;
+    uint64_t top   = (k % (HIST_SUB/2)) + (HIST_SUB/2);
+
+    return ((top + 1) << shift) - 1;
+}
+
+
+// Format nanoseconds in the most readable unit
+static char *
+fmt_ns(char *buf, size_t bsiz, uint64_t ns)
+{
+    if (ns < 1000) {
+        snprintf(buf, bsiz, "%" PRIu64 "ns", ns);
+    } else if (ns < 1000000) {
+        snprintf(buf, bsiz, "%.1fus", ns / 1.0e3);
+    } else if (ns < 1000000000) {
+        snprintf(buf, bsiz, "%.2fms", ns / 1.0e6);
+    } else {
+        snprintf(buf, bsiz, "%.3fs", ns / 1.0e9);
+    }
+    return buf;
+}
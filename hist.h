@@ -0,0 +1,111 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * hist.h - fixed size log-linear latency histograms
+ *
+ * Copyright (c) 2018 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2 
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___HIST_H__c3Q8vLx0TzKw1pNe___
+#define ___HIST_H__c3Q8vLx0TzKw1pNe___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * HDR style histogram: values below HIST_SUB are recorded exactly;
+ * every power of 2 above that is split into HIST_SUB/2 linear
+ * buckets (~3% precision). Values are in nanoseconds and saturate
+ * at 2^HIST_MAX_BITS (~18 mins).
+ *
+ * Adding a value is a handful of integer ops; there is no
+ * allocation.
+ */
+#define HIST_SUB_BITS   6
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS   40
+#define HIST_NBUCKETS   (HIST_SUB + ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * (HIST_SUB/2)))
+
+struct Hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+
+    uint64_t b[HIST_NBUCKETS];
+};
+typedef struct Hist Hist;
+
+
+/*
+ * Return the bucket for value 'v'.
+ */
+static inline uint32_t
+__hist_bucket(uint64_t v)
+{
+    if (v < HIST_SUB) return v;
+
+    if (v >= (1ULL << HIST_MAX_BITS)) v = (1ULL << HIST_MAX_BITS) - 1;
+
+    uint32_t msb   = 63 - __builtin_clzll(v);
+    uint32_t shift = msb - HIST_SUB_BITS + 1;
+    uint32_t top   = v >> shift;
+
+    return HIST_SUB + ((shift - 1) * (HIST_SUB/2)) + (top - (HIST_SUB/2));
+}
+
+
+/*
+ * Record 'v' in the histogram. A histogram must only be updated by
+ * one thread; readers on other threads see a slightly stale (but
+ * consistent enough) view.
+ */
+static inline void
+Hist_add(Hist *h, uint64_t v)
+{
+    uint32_t i = __hist_bucket(v);
+
+    __atomic_store_n(&h->b[i], h->b[i] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum, h->sum + v, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+    if (v > h->max) __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Return the value at percentile 'pct' (0..100); the value returned
+ * is the upper bound of the bucket.
+ */
+uint64_t Hist_pct(const Hist *h, double pct);
+
+/*
+ * Print a one line summary of 'h' (p50/p90/p99/p99.9/max) prefixed
+ * by 'name'.
+ */
+void Hist_print(FILE *fp, const char *name, const Hist *h);
+
+/*
+ * Add the samples in 'src' to 'dst'. The caller serializes writers
+ * of 'dst'.
+ */
+void Hist_merge(Hist *dst, const Hist *src);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___HIST_H__c3Q8vLx0TzKw1pNe___ */
+
+/* EOF */
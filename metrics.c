@@ -0,0 +1,243 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * metrics.c - Prometheus textfile and shared memory metrics
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes
+ * =====
+ * Everything here is called from the reporter thread; we only read
+ * the counters in Acctg.
+ *
+ * o  metrics=PATH: every metrics_interval we write a Prometheus
+ *    textfile (for node_exporter's textfile collector) to a temp
+ *    file and atomically rename(2) it to PATH.
+ *
+ * o  metrics_shm=PATH: a Metrics_shm struct (metrics.h) mmap'd
+ *    from PATH; updated on every reporter tick.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "error.h"
+#include "utils/utils.h"
+#include "fastdd.h"
+#include "metrics.h"
+
+struct metrics {
+    Acctg *g;
+    Args  *a;
+
+    uint64_t start;
+    uint64_t next;      // time of next textfile update
+
+    uint64_t prev_t;    // for the current rate
+    uint64_t prev_n;
+    uint64_t rate;
+
+    Metrics_shm *shm;
+    char label[PATH_MAX+16];
+};
+typedef struct metrics metrics;
+
+static metrics M;
+
+static int  write_textfile(metrics *m, int done);
+static void update_shm(metrics *m, int done);
+static void escape_label(char *buf, size_t bsiz, const char *s);
+
+
+/*
+ * Set up the exporters requested in 'a'.
+ * Returns 0 on success, -errno on failure.
+ */
+int
+Metrics_open(Acctg *g, Args *a)
+{
+    metrics *m = &M;
+
+    memset(m, 0, sizeof *m);
+
+    m->g      = g;
+    m->a      = a;
+    m->start  = m->prev_t = timenow();
+    m->next   = m->start;
+
+    escape_label(m->label, sizeof m->label, a->outfile);
+
+    if (strlen(a->metrics_shm) > 0) {
+        int fd = open(a->metrics_shm, O_RDWR|O_CREAT|O_TRUNC, 0644);
+        if (fd < 0) return -errno;
+
+        if (ftruncate(fd, sizeof(Metrics_shm)) < 0) {
+            int err = errno;
+            close(fd);
+            return -err;
+        }
+
+        void *p = mmap(0, sizeof(Metrics_shm), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) return -errno;
+
+        m->shm = p;
+        m->shm->magic   = METRICS_MAGIC;
+        m->shm->version = METRICS_VERSION;
+        m->shm->pid     = getpid();
+    }
+
+    return 0;
+}
+
+
+/*
+ * Update the exporters; called on every reporter tick. 'done' is
+ * set on the last call.
+ */
+void
+Metrics_update(uint64_t now, int done)
+{
+    metrics *m = &M;
+    Args    *a = m->a;
+
+    if (!m->a) return;
+
+    // current rate: measured over the previous interval
+    if (now > m->prev_t) {
+        uint64_t n = Acct_get(&m->g->nwr);
+
+        m->rate   = (uint64_t)((double)(n - m->prev_n) * 1.0e9 / (double)(now - m->prev_t));
+        m->prev_t = now;
+        m->prev_n = n;
+    }
+
+    if (m->shm) update_shm(m, done);
+
+    if (strlen(a->metrics) > 0 && (done || now >= m->next)) {
+        int r = write_textfile(m, done);
+        if (r < 0) warn("can't write metrics to %s: %s", a->metrics, strerror(-r));
+
+        m->next = now + a->metrics_intv;
+    }
+}
+
+
+/*
+ * Tear down the exporters.
+ */
+void
+Metrics_close(void)
+{
+    metrics *m = &M;
+
+    if (m->shm) munmap(m->shm, sizeof(Metrics_shm));
+    m->shm = 0;
+    m->a   = 0;
+}
+
+
+// Write one metric with the output label
+#define _metric(fp, m, name, typ, help, fmt, v)  do { \
+                fprintf(fp, "# HELP fastdd_%s %s\n# TYPE fastdd_%s %s\n", name, help, name, typ); \
+                fprintf(fp, "fastdd_%s{output=\"%s\"} " fmt "\n", name, (m)->label, v); \
+            } while (0)
+
+static int
+write_textfile(metrics *m, int done)
+{
+    Acctg *g = m->g;
+    Args  *a = m->a;
+    char tmp[PATH_MAX+32];
+
+    snprintf(tmp, sizeof tmp, "%s.%d.tmp", a->metrics, (int)getpid());
+
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return -errno;
+
+    uint64_t nwr = Acct_get(&g->nwr);
+    uint64_t nrd = Acct_get(&g->nrd);
+    double   el  = (double)(timenow() - m->start) / 1.0e9;
+    double   pct = a->insize > 0 ? (double)nwr / (double)a->insize : 0.0;
+
+    _metric(fp, m, "bytes_read_total",    "counter", "Bytes read from the input.", "%" PRIu64, nrd);
+    _metric(fp, m, "bytes_written_total", "counter", "Bytes written to the output.", "%" PRIu64, nwr);
+    _metric(fp, m, "input_size_bytes",    "gauge",   "Bytes to copy (0 if unknown).", "%" PRIu64, a->insize);
+    _metric(fp, m, "progress_ratio",      "gauge",   "Fraction of the input copied.", "%.6f", pct);
+    _metric(fp, m, "throughput_bytes_per_second", "gauge", "Current write throughput.", "%" PRIu64, m->rate);
+    _metric(fp, m, "avg_throughput_bytes_per_second", "gauge", "Average write throughput.",
+            "%.0f", el > 0.0 ? (double)nwr / el : 0.0);
+    _metric(fp, m, "elapsed_seconds",     "gauge",   "Time since the copy started.", "%.3f", el);
+    _metric(fp, m, "errors_total",        "counter", "I/O errors.", "%" PRIu64, Acct_get(&g->nerrors));
+
+    if (g->qsize > 0) {
+        _metric(fp, m, "queue_depth",    "gauge", "I/O blocks queued for the writer.", "%" PRIu64,
+                Acct_get(&g->nenq) - Acct_get(&g->ndeq));
+        _metric(fp, m, "queue_capacity", "gauge", "Capacity of the writer queue.", "%" PRIu64, g->qsize);
+    }
+
+    _metric(fp, m, "done", "gauge", "Set to 1 when the copy is over.", "%d", done);
+
+    if (fclose(fp) != 0 || rename(tmp, a->metrics) < 0) {
+        int err = errno;
+        unlink(tmp);
+        return -err;
+    }
+    return 0;
+}
+
+
+static void
+update_shm(metrics *m, int done)
+{
+    Metrics_shm *s = m->shm;
+    Acctg       *g = m->g;
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    s->nrd     = Acct_get(&g->nrd);
+    s->nwr     = Acct_get(&g->nwr);
+    s->insize  = m->a->insize;
+    s->elapsed = timenow() - m->start;
+    s->rate    = m->rate;
+    s->qsize   = g->qsize;
+    s->qdepth  = g->qsize > 0 ? Acct_get(&g->nenq) - Acct_get(&g->ndeq) : 0;
+    s->nerrors = Acct_get(&g->nerrors);
+    s->done    = done;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+}
+
+
+// Escape 's' for use as a Prometheus label value
+static void
+escape_label(char *buf, size_t bsiz, const char *s)
+{
+    char *end = buf + bsiz - 3;
+
+    for (; *s && buf < end; s++) {
+        if (*s == '\\' || *s == '"') {
+            *buf++ = '\\';
+            *buf++ = *s;
+        } else if (*s == '\n') {
+            *buf++ = '\\';
+            *buf++ = 'n';
+        } else {
+            *buf++ = *s;
+        }
+    }
+    *buf = 0;
+}
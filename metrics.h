@@ -0,0 +1,68 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * metrics.h - metrics exported for external monitors
+ *
+ * Copyright (c) 2018 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2 
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___METRICS_H__q7XbT2mWl9RdKc4a___
+#define ___METRICS_H__q7XbT2mWl9RdKc4a___ 1
+
+    /* Provide C linkage for symbols declared here .. */
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdint.h>
+
+/*
+ * Layout of the file published via metrics_shm=PATH. External
+ * monitors mmap(2) the file read-only and read it without any
+ * syscalls.
+ *
+ * 'seq' is a sequence lock: the writer makes it odd before an
+ * update and even after. Readers retry if 'seq' is odd or changes
+ * while they copy the struct.
+ *
+ * All sizes are in bytes, times in nanoseconds.
+ */
+#define METRICS_MAGIC       0x66646d31  // "fdm1"
+#define METRICS_VERSION     1
+
+struct Metrics_shm {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    uint32_t pid;
+
+    uint64_t nrd;           // bytes read
+    uint64_t nwr;           // bytes written
+    uint64_t insize;        // bytes to copy (0 => unknown)
+    uint64_t elapsed;       // time since copy started
+    uint64_t rate;          // current throughput (bytes/sec)
+
+    uint64_t qdepth;        // descriptors queued for the writer
+    uint64_t qsize;         // capacity of the queue (0 => no queue)
+
+    uint64_t nerrors;       // I/O errors
+    uint32_t done;          // set when the copy is over
+    uint32_t _pad;
+};
+typedef struct Metrics_shm Metrics_shm;
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* ! ___METRICS_H__q7XbT2mWl9RdKc4a___ */
+
+/* EOF */
@@ -25,6 +25,8 @@ static const struct option Long_options[] =
 {
       {"help",                            no_argument,       0, 300}
     , {"quiet",                           no_argument,       0, 302}
+    , {"histogram",                       no_argument,       0, 304}
+    , {"explain",                         no_argument,       0, 306}
 
     , {0, 0, 0, 0}
 };
@@ -55,9 +57,13 @@ opt_parse(opt_option * opt, int argc, char * const *argv)
 
     opt->help = 0;
     opt->quiet = 0;
+    opt->histogram = 0;
+    opt->explain = 0;
 
     opt->help_present = 0;
     opt->quiet_present = 0;
+    opt->histogram_present = 0;
+    opt->explain_present = 0;
 
 
     opt->argv_inputs = 0;
@@ -88,6 +94,16 @@ opt_parse(opt_option * opt, int argc, char * const *argv)
             opt->quiet_present = 1;
             break;
 
+        case 304:  /* histogram */
+            opt->histogram = 1;
+            opt->histogram_present = 1;
+            break;
+
+        case 306:  /* explain */
+            opt->explain = 1;
+            opt->explain_present = 1;
+            break;
+
 
 
         default:
@@ -119,6 +135,8 @@ show_help(void)
 "\nOptions (defaults within '[ ]'):\n"
 "    --help, -h    Print this help and exit [false]\n"
 "    --quiet, -q   Be silent; don't print progress messages [false]\n"
+"    --histogram   Print latency percentiles of each kind of I/O syscall [false]\n"
+"    --explain     Print the copy plan (engine, iosize etc.) and exit [false]\n"
 ;
 
     fflush(stdout);
@@ -50,6 +50,8 @@ struct opt_option
 
     int help;
     int quiet;
+    int histogram;
+    int explain;
 
 
     /*
@@ -58,6 +60,8 @@ struct opt_option
      */
     char help_present;
     char quiet_present;
+    char histogram_present;
+    char explain_present;
 
 };
 typedef struct opt_option opt_option;
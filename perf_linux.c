@@ -0,0 +1,171 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * perf_linux.c - self-profiling with perf_event_open(2)
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ * o  Each counter is opened separately with 'inherit' set; the
+ *    kernel doesn't allow group reads of inherited counters.
+ *
+ * o  Hardware counters are usually missing in VMs; we fall back to
+ *    the software counters. If perf_event_paranoid forbids kernel
+ *    profiling we retry with exclude_kernel (splice time is then
+ *    invisible - we note it in the report).
+ *
+ * o  If no perf counter can be opened, context switches and faults
+ *    come from getrusage(2).
+ */
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "fastdd.h"
+
+enum {
+    P_CYCLES, P_INSTR, P_CTXSW, P_FAULTS, P_MIGR, P_MAX
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} Events[P_MAX] = {
+    [P_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [P_INSTR]  = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [P_CTXSW]  = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    [P_FAULTS] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    [P_MIGR]   = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+};
+
+static int Fds[P_MAX] = {-1, -1, -1, -1, -1};
+static int User_only  = 0;
+static struct rusage Ru0;
+
+static uint64_t tv_us(struct timeval *tv);
+static int      perf_open(uint32_t type, uint64_t config, int user_only);
+static uint64_t perf_read(int fd);
+
+
+void
+Perf_start()
+{
+    int i;
+
+    for (i = 0; i < P_MAX; i++) {
+        int fd = perf_open(Events[i].type, Events[i].config, User_only);
+
+        // Can't see kernel events; everyone else must follow suit
+        // so that the ratios are consistent.
+        if (fd == -EACCES && !User_only) {
+            int j;
+
+            User_only = 1;
+            for (j = 0; j < i; j++) {
+                if (Fds[j] >= 0) close(Fds[j]);
+                Fds[j] = perf_open(Events[j].type, Events[j].config, 1);
+            }
+            fd = perf_open(Events[i].type, Events[i].config, 1);
+        }
+        Fds[i] = fd;
+    }
+
+    getrusage(RUSAGE_SELF, &Ru0);
+}
+
+
+void
+Perf_stop(Perf *p)
+{
+    struct rusage ru;
+    uint64_t v[P_MAX];
+    int i;
+
+    for (i = 0; i < P_MAX; i++) {
+        v[i] = Fds[i] >= 0 ? perf_read(Fds[i]) : PERF_NA;
+        if (Fds[i] >= 0) close(Fds[i]);
+        Fds[i] = -1;
+    }
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    memset(p, 0, sizeof *p);
+    p->cycles     = v[P_CYCLES];
+    p->instr      = v[P_INSTR];
+    p->ctxsw      = v[P_CTXSW];
+    p->faults     = v[P_FAULTS];
+    p->migrations = v[P_MIGR];
+    p->hw         = v[P_CYCLES] != PERF_NA;
+    p->user_only  = User_only;
+
+    if (p->ctxsw == PERF_NA)
+        p->ctxsw = (ru.ru_nvcsw + ru.ru_nivcsw) - (Ru0.ru_nvcsw + Ru0.ru_nivcsw);
+    if (p->faults == PERF_NA)
+        p->faults = (ru.ru_minflt + ru.ru_majflt) - (Ru0.ru_minflt + Ru0.ru_majflt);
+
+    p->utime_us = tv_us(&ru.ru_utime) - tv_us(&Ru0.ru_utime);
+    p->stime_us = tv_us(&ru.ru_stime) - tv_us(&Ru0.ru_stime);
+    p->maxrss   = (uint64_t)ru.ru_maxrss * 1024;
+}
+
+
+/*
+ * Open a counter for this process and all its future threads.
+ * Return fd on success, -errno on failure.
+ */
+static int
+perf_open(uint32_t type, uint64_t config, int user_only)
+{
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof pe);
+    pe.size           = sizeof pe;
+    pe.type           = type;
+    pe.config         = config;
+    pe.inherit        = 1;
+    pe.exclude_hv     = 1;
+    pe.exclude_kernel = user_only;
+    pe.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    int fd = syscall(SYS_perf_event_open, &pe, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    return fd < 0 ? -errno : fd;
+}
+
+
+/*
+ * Read a counter and scale it if it was multiplexed.
+ */
+static uint64_t
+perf_read(int fd)
+{
+    uint64_t v[3];  // value, time enabled, time running
+
+    if (read(fd, v, sizeof v) != sizeof v) return PERF_NA;
+    if (v[2] == 0) return v[1] == 0 ? v[0] : PERF_NA;
+    if (v[2] < v[1]) return (uint64_t)((double)v[0] * v[1] / v[2]);
+    return v[0];
+}
+
+
+static uint64_t
+tv_us(struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* EOF */
@@ -0,0 +1,68 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * perf_posix.c - self-profiling with getrusage(2) for systems
+ * without perf counters.
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <inttypes.h>
+#include <string.h>
+#include "fastdd.h"
+
+static struct rusage Ru0;
+
+static uint64_t tv_us(struct timeval *tv);
+
+
+void
+Perf_start()
+{
+    getrusage(RUSAGE_SELF, &Ru0);
+}
+
+
+void
+Perf_stop(Perf *p)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    memset(p, 0, sizeof *p);
+    p->cycles     = PERF_NA;
+    p->instr      = PERF_NA;
+    p->migrations = PERF_NA;
+    p->ctxsw      = (ru.ru_nvcsw + ru.ru_nivcsw) - (Ru0.ru_nvcsw + Ru0.ru_nivcsw);
+    p->faults     = (ru.ru_minflt + ru.ru_majflt) - (Ru0.ru_minflt + Ru0.ru_majflt);
+
+    p->utime_us = tv_us(&ru.ru_utime) - tv_us(&Ru0.ru_utime);
+    p->stime_us = tv_us(&ru.ru_stime) - tv_us(&Ru0.ru_stime);
+
+    // ru_maxrss is in bytes on Darwin and KB elsewhere
+#ifdef __APPLE__
+    p->maxrss = ru.ru_maxrss;
+#else
+    p->maxrss = (uint64_t)ru.ru_maxrss * 1024;
+#endif
+}
+
+
+static uint64_t
+tv_us(struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* EOF */
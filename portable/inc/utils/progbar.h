@@ -42,6 +42,9 @@ typedef struct progress progress;
 // Print current & total in human units (kB/MB/GB etc.)
 #define P_HUMAN     (1 << 0)
 
+// Leave room on the line for a suffix (see progressbar_set())
+#define P_SUFFIX    (1 << 1)
+
 
 /*
  * Initialize a progress bar instance to write to 'fd'.
@@ -59,6 +62,12 @@ int progressbar_init(progress*, int fd, uint64_t total, uint32_t flags);
  */
 void progressbar_update(progress*, uint64_t incr);
 
+/*
+ * Set the progress bar to an absolute value of 'cur' and append
+ * 'suffix' (if non-null) after the bar.
+ */
+void progressbar_set(progress*, uint64_t cur, const char *suffix);
+
 /*
  * Finish/complete the progress bar by writing a '\n' to the output.
  * If 'clr' is true, then erase the current line. Else, write '\n'.
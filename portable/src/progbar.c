@@ -33,8 +33,14 @@
 // 0x1B[2k => ESC[2K
 #define CLR     "\x1B[2K\r"
 
+// Columns used by the text around the bar; and the columns we
+// leave for the suffix when P_SUFFIX is set.
+#define PREFIX_COLS     28
+#define SUFFIX_COLS     40
+
 static void update_total_progress(char *buf, size_t bsize, progress *p);
 static void update_incr_progress(char *buf, size_t bsize, progress *p);
+static void redraw(progress *p, const char *suffix);
 
 
 int
@@ -52,11 +58,19 @@ progressbar_init(progress *p, int fd, uint64_t total, uint32_t flags)
     // try to get the actual width, else punt.
     if (ioctl(fd, TIOCGWINSZ, &w) != 0) w.ws_col = 80;
 
+    // The prefix and completion percent take up PREFIX_COLS; the
+    // bar gets the rest (upto a max of 50).
+    int32_t cols = w.ws_col - PREFIX_COLS;
+
+    if (flags & P_SUFFIX) cols -= SUFFIX_COLS;
+    if (cols > 50) cols = 50;
+    if (cols < 10) cols = 10;
+
     p->total = total;
     p->fd    = fd;
     p->cur   = 0;
     p->flags = flags;
-    p->width = w.ws_col > 50 ? 50 : w.ws_col / 2;
+    p->width = cols;
     p->step  = 100 / p->width;
 
     return 0;
@@ -66,11 +80,29 @@ progressbar_init(progress *p, int fd, uint64_t total, uint32_t flags)
 void
 progressbar_update(progress *p, uint64_t incr)
 {
-    char buf[512];
-
     if (p->fd < 0) return;
 
     p->cur += incr;
+    redraw(p, 0);
+}
+
+
+void
+progressbar_set(progress *p, uint64_t cur, const char *suffix)
+{
+    if (p->fd < 0) return;
+
+    p->cur = cur;
+    redraw(p, suffix);
+}
+
+
+// Draw the progress bar if it is different from what's on the
+// screen.
+static void
+redraw(progress *p, const char *suffix)
+{
+    char buf[512];
 
     if (p->total > 0) {
         update_total_progress(buf, sizeof buf, p);
@@ -78,6 +110,11 @@ progressbar_update(progress *p, uint64_t incr)
         update_incr_progress(buf, sizeof buf, p);
     }
 
+    if (suffix) {
+        size_t n = strlen(buf);
+        snprintf(buf+n, (sizeof buf) - n, " %s", suffix);
+    }
+
     if (0 != strcmp(p->buf, buf)) {
         size_t n = strcopy(p->buf, sizeof p->buf, buf);
 
@@ -116,7 +153,7 @@ update_total_progress(char *buf, size_t bsize, progress *p)
 
     if (pct > 100) pct = 100;
 
-    uint64_t done = pct / p->step;
+    uint64_t done = (pct * p->width) / 100;
     uint64_t rem  = p->width - done;
 
     assert(done < (sizeof fill)-1);
@@ -0,0 +1,65 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * probes.h - USDT static probes
+ *
+ * Copyright (c) 2018 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2 
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ */
+
+#ifndef ___PROBES_H__Rk2nW8xYb5LcT0gF___
+#define ___PROBES_H__Rk2nW8xYb5LcT0gF___ 1
+
+/*
+ * Static probes for bpftrace/systemtap/perf under the provider
+ * "fastdd". The makefile defines HAVE_SDT when <sys/sdt.h> is
+ * available; an unattached probe is a single nop. The probes are:
+ *
+ *   copy__start(insize, iosize)
+ *   copy__end(bytes_written, elapsed_us)
+ *   read__start(fd, want)          -- read(2) or input half of splice
+ *   chunk__read(fd, ret)
+ *   write__start(fd, want)         -- write(2) or output half of splice
+ *   chunk__write(fd, ret)
+ *   splice__start(fd, want)        -- splice from input to output
+ *   splice__done(fd, ret)
+ *   queue__block(q)                -- about to wait on queue q
+ *   queue__unblock(q)              -- done waiting on queue q
+ *
+ * 'ret' is the I/O's return value: bytes moved, or < 0 on error. For the
+ * queue probes, q is PQ_FREE or PQ_IO. The start/end pairs fire on
+ * the same thread; per-chunk latency is the difference of their
+ * timestamps. e.g.,
+ *
+ *   bpftrace -e 'usdt:./fastdd:fastdd:write__start { @t[tid] = nsecs; }
+ *                usdt:./fastdd:fastdd:chunk__write /@t[tid]/ {
+ *                    @us = hist((nsecs - @t[tid]) / 1000); delete(@t[tid]); }'
+ */
+
+#define PQ_FREE     0
+#define PQ_IO       1
+
+#ifdef HAVE_SDT
+
+#include <sys/sdt.h>
+
+#define PROBE1(n, a)        DTRACE_PROBE1(fastdd, n, a)
+#define PROBE2(n, a, b)     DTRACE_PROBE2(fastdd, n, a, b)
+
+#else
+
+#define PROBE1(n, a)        do { } while (0)
+#define PROBE2(n, a, b)     do { } while (0)
+
+#endif /* HAVE_SDT */
+
+#endif /* ! ___PROBES_H__Rk2nW8xYb5LcT0gF___ */
+
+/* EOF */
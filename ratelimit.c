@@ -0,0 +1,80 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * ratelimit.c - token bucket to cap the copy bandwidth
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes
+ * =====
+ * The engines charge the bucket _after_ each transfer; the bucket
+ * can go into debt by at most one I/O block (iosize is clamped to
+ * the burst). When in debt, we sleep until the debt is repaid. This
+ * keeps the accounting out of the way of splice(2): we never have
+ * to know ahead of time how much the kernel will move.
+ */
+#include <time.h>
+#include <errno.h>
+
+#include "utils/utils.h"
+#include "fastdd.h"
+
+
+/*
+ * Initialize a token bucket for 'rate' bytes/sec with a depth of
+ * 'burst' bytes. A zero rate means unlimited.
+ */
+void
+Ratelimit_init(Ratelimit *rl, uint64_t rate, uint64_t burst)
+{
+    rl->rate   = rate;
+    rl->burst  = burst;
+    rl->tokens = burst;
+    rl->last   = timenow();
+}
+
+
+/*
+ * Charge 'n' bytes to the bucket and sleep if we're over the
+ * limit.
+ */
+void
+Ratelimit_charge(Ratelimit *rl, uint64_t n)
+{
+    uint64_t now = timenow();
+
+    rl->tokens += (int64_t)((double)(now - rl->last) * rl->rate / 1.0e9);
+    rl->last    = now;
+    if (rl->tokens > (int64_t)rl->burst) rl->tokens = rl->burst;
+
+    rl->tokens -= n;
+    if (rl->tokens >= 0) return;
+
+    // Sleep till the debt is paid off.
+    uint64_t wait = (uint64_t)((double)(-rl->tokens) * 1.0e9 / rl->rate);
+    struct timespec ts;
+
+#ifdef TIMER_ABSTIME
+    uint64_t then = now + wait;
+
+    ts.tv_sec  = then / _Second(1);
+    ts.tv_nsec = then % _Second(1);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+        ;
+#else
+    struct timespec rem;
+
+    ts.tv_sec  = wait / _Second(1);
+    ts.tv_nsec = wait % _Second(1);
+    while (nanosleep(&ts, &rem) < 0 && errno == EINTR)
+        ts = rem;
+#endif
+}
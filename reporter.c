@@ -0,0 +1,320 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * reporter.c - timer driven progress reporting
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes
+ * =====
+ * The engines only bump the byte counters in Acctg; a separate
+ * thread wakes up at a fixed rate and redraws the progress bar from
+ * those counters. Nothing here touches the data path.
+ *
+ * The same thread prints a stats snapshot every status_interval
+ * and on SIGUSR1 (like GNU dd). SIGUSR1 is blocked in every other
+ * thread; the handler only sets a flag that the reporter picks up
+ * on its next tick.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "error.h"
+#include "utils/utils.h"
+#include "utils/progbar.h"
+#include "fastdd.h"
+
+// Redraw interval
+#define REDRAW_INTERVAL     _Millisecond(250)
+
+struct reporter {
+    pthread_t       id;
+    pthread_mutex_t lock;
+    pthread_cond_t  cv;
+
+    int running;
+    int stop;
+
+    Acctg *g;
+    Args  *a;
+
+    progress p;
+
+    uint64_t start;     // time the copy started (ns)
+    uint64_t prev_t;    // time of previous redraw
+    uint64_t prev_n;    // bytes written as of previous redraw
+    double   rate;      // smoothed instantaneous rate (bytes/sec)
+
+    uint64_t next_snap; // time of next periodic snapshot (0 => never)
+    uint64_t snap_t;    // time of previous snapshot
+    uint64_t snap_n;    // bytes written as of previous snapshot
+};
+typedef struct reporter reporter;
+
+static reporter R;
+
+// Set by the SIGUSR1 handler
+static volatile sig_atomic_t Snap = 0;
+
+static void* reporter_thread(void *v);
+static void  redraw(reporter *r);
+static void  snapshot(reporter *r, uint64_t now);
+static void  sigusr1(int sig);
+static char* fmt_rate(char *buf, size_t bsiz, double rate);
+static char* fmt_eta(char *buf, size_t bsiz, double secs);
+
+
+/*
+ * Start the reporter thread. This must be called before any other
+ * threads are created (so that they inherit the blocked SIGUSR1).
+ */
+int
+Reporter_start(Acctg *g, Args *a)
+{
+    reporter *r = &R;
+    sigset_t  ss;
+
+    memset(r, 0, sizeof *r);
+
+    r->g      = g;
+    r->a      = a;
+    r->start  = r->prev_t = r->snap_t = timenow();
+
+    if (a->status_intv > 0) r->next_snap = r->start + a->status_intv;
+
+    progressbar_init(&r->p, Quiet ? -1 : 2, a->insize, P_HUMAN|P_SUFFIX);
+
+    int x = Metrics_open(g, a);
+    if (x < 0) return x;
+
+    // Only the reporter thread takes SIGUSR1.
+    sigemptyset(&ss);
+    sigaddset(&ss, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &ss, 0);
+
+    pthread_mutex_init(&r->lock, 0);
+    pthread_cond_init(&r->cv, 0);
+
+    x = pthread_create(&r->id, 0, reporter_thread, r);
+    if (x != 0) return -x;
+
+    r->running = 1;
+    return 0;
+}
+
+
+/*
+ * Stop the reporter and clear the progress bar. 'ok' is false when
+ * we're stopping due to an error.
+ */
+void
+Reporter_stop(int ok)
+{
+    reporter *r = &R;
+
+    if (!r->running) return;
+
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_signal(&r->cv);
+    pthread_mutex_unlock(&r->lock);
+
+    pthread_join(r->id, 0);
+    r->running = 0;
+
+    if (!ok) Acct_add(&r->g->nerrors, 1);
+
+    Metrics_update(timenow(), 1);
+    Metrics_close();
+
+    if (ok) {
+        // don't write a newline; only clear the current line
+        progressbar_finish(&r->p, 1, 0);
+    } else {
+        progressbar_finish(&r->p, 0, 1);
+    }
+
+    pthread_cond_destroy(&r->cv);
+    pthread_mutex_destroy(&r->lock);
+}
+
+
+static void *
+reporter_thread(void *v)
+{
+    reporter *r = v;
+    struct sigaction sa;
+    sigset_t ss;
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = sigusr1;
+    sa.sa_flags   = SA_RESTART;
+    sigaction(SIGUSR1, &sa, 0);
+
+    sigemptyset(&ss);
+    sigaddset(&ss, SIGUSR1);
+    pthread_sigmask(SIG_UNBLOCK, &ss, 0);
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->stop) {
+        struct timeval  tv;
+        struct timespec ts;
+
+        gettimeofday(&tv, 0);
+
+        uint64_t then = _Second(tv.tv_sec) + _Microsecond(tv.tv_usec) + REDRAW_INTERVAL;
+
+        ts.tv_sec  = then / _Second(1);
+        ts.tv_nsec = then % _Second(1);
+
+        pthread_cond_timedwait(&r->cv, &r->lock, &ts);
+        if (r->stop) break;
+
+        pthread_mutex_unlock(&r->lock);
+
+        uint64_t now = timenow();
+
+        if (Snap || (r->next_snap > 0 && now >= r->next_snap)) {
+            Snap = 0;
+            snapshot(r, now);
+            while (r->next_snap > 0 && r->next_snap <= now)
+                r->next_snap += r->a->status_intv;
+        }
+
+        redraw(r);
+        Metrics_update(now, 0);
+        pthread_mutex_lock(&r->lock);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+
+
+/*
+ * Redraw the progress bar with the current and average throughput
+ * and the ETA (when the input size is known).
+ */
+static void
+redraw(reporter *r)
+{
+    if (r->p.fd < 0) return;
+
+    uint64_t now = timenow();
+    uint64_t n   = Acct_get(&r->g->nwr) + Acct_get(&r->g->elided);
+    double   dt  = (double)(now - r->prev_t) / 1.0e9;
+    double   el  = (double)(now - r->start) / 1.0e9;
+
+    if (dt <= 0.0 || el <= 0.0) return;
+
+    // exponentially smoothed instantaneous rate
+    double inst = (double)(n - r->prev_n) / dt;
+    r->rate   = r->prev_n == 0 ? inst : (0.5 * inst) + (0.5 * r->rate);
+    r->prev_t = now;
+    r->prev_n = n;
+
+    double avg = (double)n / el;
+    char cur[48],
+         av[48],
+         eta[32],
+         suff[160];
+
+    fmt_rate(cur, sizeof cur, r->rate);
+    fmt_rate(av,  sizeof av,  avg);
+
+    if (r->a->insize > 0 && avg > 0.0 && n < r->a->insize) {
+        fmt_eta(eta, sizeof eta, (double)(r->a->insize - n) / avg);
+        snprintf(suff, sizeof suff, "%s (avg %s) ETA %s", cur, av, eta);
+    } else {
+        snprintf(suff, sizeof suff, "%s (avg %s)", cur, av);
+    }
+
+    progressbar_set(&r->p, n, suff);
+}
+
+
+/*
+ * Print a snapshot of the stats so far: bytes, current and average
+ * throughput and the latency percentiles (if we're timing I/O).
+ */
+static void
+snapshot(reporter *r, uint64_t now)
+{
+    Acctg   *g  = r->g;
+    uint64_t n  = Acct_get(&g->nwr);
+    double   dt = (double)(now - r->snap_t) / 1.0e9;
+    double   el = (double)(now - r->start)  / 1.0e9;
+    char sz[32],
+         cur[48],
+         av[48];
+    int i;
+
+    fmt_rate(cur, sizeof cur, dt > 0.0 ? (double)(n - r->snap_n) / dt : 0.0);
+    fmt_rate(av,  sizeof av,  el > 0.0 ? (double)n / el : 0.0);
+    humanize_size(sz, sizeof sz, n);
+
+    r->snap_t = now;
+    r->snap_n = n;
+
+    // Get the progress bar out of the way; it'll be redrawn in full
+    // on the next tick.
+    if (r->p.fd >= 0) {
+        progressbar_finish(&r->p, 1, 0);
+        r->p.buf[0] = 0;
+        r->p.lines  = 0;
+    }
+
+    fprintf(stderr, "%s (%" PRIu64 " bytes) copied in %.1f secs; %s now, %s avg\n",
+            sz, n, el, cur, av);
+
+    if (g->timing) {
+        for (i = 0; i < LAT_MAX; i++) {
+            Hist *h = &g->lat[i];
+
+            if (Acct_get(&h->count) > 0) Hist_print(stderr, Evnames[i], h);
+        }
+    }
+    fflush(stderr);
+}
+
+
+static void
+sigusr1(int sig)
+{
+    USEARG(sig);
+    Snap = 1;
+}
+
+
+static char *
+fmt_rate(char *buf, size_t bsiz, double rate)
+{
+    char t[32];
+
+    humanize_size(t, sizeof t, (uint64_t)rate);
+    snprintf(buf, bsiz, "%s/s", t);
+    return buf;
+}
+
+
+static char *
+fmt_eta(char *buf, size_t bsiz, double secs)
+{
+    uint64_t s = (uint64_t)secs;
+
+    snprintf(buf, bsiz, "%" PRIu64 ":%02" PRIu64 ":%02" PRIu64 "",
+            s / 3600, (s / 60) % 60, s % 60);
+    return buf;
+}
@@ -0,0 +1,269 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * scan.c - the scan mode: read latency and errors per region of
+ *          the input.
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ *
+ * o  A scan is a copy to of=null: with the shard engine; it calls
+ *    Scan_add() for every chunk it reads. The input is cut into at
+ *    most SCAN_REGIONS regions of a whole number of chunks; so a
+ *    chunk never straddles two regions.
+ *
+ * o  The shard threads update the regions concurrently with relaxed
+ *    atomics; nobody reads them until the scan is done.
+ *
+ * o  A region is as slow as its mean read time relative to the
+ *    median of all the regions; each heat level is ~1.4x slower than
+ *    the one before.
+ */
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "utils/new.h"
+#include "fastdd.h"
+
+// Max regions (and cells in the heatmap)
+#define SCAN_REGIONS    1024
+
+// Cells per line of the heatmap
+#define SCAN_COLS       64
+
+// Heat levels; ' ' is under 2x the median
+static const char Heat[] = " .:-=+*#%";
+#define HEAT_MAX        ((int)sizeof Heat - 2)
+
+// Regions at or above this level are listed as slow
+#define HEAT_SLOW       3
+
+// Max slow regions listed on stderr; the CSV has all of them
+#define SCAN_LIST       16
+
+static int  heat(const Scanregion *r, double median);
+static double mean_ns(const Scanregion *r);
+static double median_ns(const Scanmap *m);
+static int  cmpdbl(const void *a, const void *b);
+
+
+/*
+ * Make a map for the input range of 'a', read in chunks of
+ * a->iosize bytes.
+ */
+Scanmap *
+Scan_new(Args *a)
+{
+    Scanmap *m   = NEWZ(Scanmap);
+    uint64_t io  = a->iosize;
+    uint64_t per = (a->insize + SCAN_REGIONS - 1) / SCAN_REGIONS;
+
+    m->base  = a->skip;
+    m->len   = a->insize;
+    m->lbs   = a->inputs[0].dev.lbs ? a->inputs[0].dev.lbs : 512;
+    m->rsize = ((per + io - 1) / io) * io;
+    if (m->rsize == 0) m->rsize = io;
+
+    m->n = (a->insize + m->rsize - 1) / m->rsize;
+    m->r = NEWZA(Scanregion, m->n > 0 ? m->n : 1);
+    return m;
+}
+
+
+void
+Scan_free(Scanmap *m)
+{
+    DEL(m->r);
+    DEL(m);
+}
+
+
+/*
+ * Record a read at input offset 'off' (relative to skip=) that took
+ * 'ns' and failed with 'err' (0 if it didn't).
+ */
+void
+Scan_add(Scanmap *m, uint64_t off, uint64_t ns, int err)
+{
+    Scanregion *r = &m->r[off / m->rsize];
+    uint64_t mx   = __atomic_load_n(&r->max_ns, __ATOMIC_RELAXED);
+
+    if (err != 0) {
+        __atomic_fetch_add(&r->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_fetch_add(&r->reads,  1,  __ATOMIC_RELAXED);
+    __atomic_fetch_add(&r->sum_ns, ns, __ATOMIC_RELAXED);
+    while (ns > mx && !__atomic_compare_exchange_n(&r->max_ns, &mx, ns, 1,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+
+/*
+ * Return the number of slow regions in '*slow' and of regions with
+ * errors in '*bad'.
+ */
+void
+Scan_count(const Scanmap *m, uint32_t *slow, uint32_t *bad)
+{
+    double md = median_ns(m);
+    uint32_t i;
+
+    *slow = *bad = 0;
+    for (i = 0; i < m->n; i++) {
+        const Scanregion *r = &m->r[i];
+
+        if (r->errors > 0)                 (*bad)++;
+        else if (heat(r, md) >= HEAT_SLOW) (*slow)++;
+    }
+}
+
+
+/*
+ * Print a summary, the heatmap and the worst regions.
+ */
+void
+Scan_print(FILE *fp, const Scanmap *m)
+{
+    double md = median_ns(m);
+    uint32_t i, slow, bad, nl = 0;
+    char sz[64];
+
+    Scan_count(m, &slow, &bad);
+    humanize_size(sz, sizeof sz, m->rsize);
+
+    fprintf(fp, "scan: %u regions of %s; median read %.3f ms; %u slow, %u with errors\n",
+                m->n, sz, md / 1.0e6, slow, bad);
+    fprintf(fp, "heatmap: '%c' under 2x the median, then \"%s\" ~1.4x slower each; X errors\n",
+                Heat[0], Heat + 1);
+
+    for (i = 0; i < m->n; i++) {
+        const Scanregion *r = &m->r[i];
+
+        if ((i % SCAN_COLS) == 0)
+            fprintf(fp, "%s%12" PRIu64 " |", i > 0 ? "|\n" : "", (m->base + i * m->rsize) / m->lbs);
+
+        fputc(r->errors > 0 ? 'X' : r->reads == 0 ? '?' : Heat[heat(r, md)], fp);
+    }
+    if (m->n > 0) fprintf(fp, "|\n");
+
+    for (i = 0; i < m->n && nl < SCAN_LIST; i++) {
+        const Scanregion *r = &m->r[i];
+        uint64_t lba = (m->base + i * m->rsize) / m->lbs;
+
+        if (r->errors == 0 && heat(r, md) < HEAT_SLOW) continue;
+
+        if (nl++ == 0) fprintf(fp, "slow or failing regions (lba):\n");
+        fprintf(fp, "    %" PRIu64 "-%" PRIu64 ": %" PRIu64 " reads, mean %.3f ms, max %.3f ms, %" PRIu64 " errors\n",
+                    lba, lba + m->rsize / m->lbs - 1, r->reads, mean_ns(r) / 1.0e6,
+                    r->max_ns / 1.0e6, r->errors);
+    }
+    if (nl == SCAN_LIST && (slow + bad) > nl)
+        fprintf(fp, "    .. and %u more\n", slow + bad - nl);
+}
+
+
+/*
+ * Write every region as a line of CSV to 'fn'. Return 0 on success,
+ * -errno on failure.
+ */
+int
+Scan_csv(const Scanmap *m, const char *fn)
+{
+    double md = median_ns(m);
+    FILE *fp  = fopen(fn, "w");
+    uint32_t i;
+
+    if (!fp) return -errno;
+
+    fprintf(fp, "lba_start,lba_end,reads,errors,mean_us,max_us,heat\n");
+    for (i = 0; i < m->n; i++) {
+        const Scanregion *r = &m->r[i];
+        uint64_t lo = m->base + i * m->rsize;
+        uint64_t hi = lo + m->rsize;
+
+        if (hi > m->base + m->len) hi = m->base + m->len;
+
+        fprintf(fp, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.1f,%.1f,%d\n",
+                    lo / m->lbs, (hi + m->lbs - 1) / m->lbs - 1, r->reads, r->errors,
+                    mean_ns(r) / 1.0e3, r->max_ns / 1.0e3, r->reads > 0 ? heat(r, md) : -1);
+    }
+
+    if (fclose(fp) != 0) return -errno;
+    return 0;
+}
+
+
+/*
+ * Return the heat level of 'r': 0 under twice the median, then one
+ * level per factor of sqrt(2).
+ */
+static int
+heat(const Scanregion *r, double median)
+{
+    double x = 2.0 * median;
+    double v = mean_ns(r);
+    int h;
+
+    for (h = 0; h < HEAT_MAX && v >= x; h++) x *= 1.41421356;
+    return h;
+}
+
+
+static double
+mean_ns(const Scanregion *r)
+{
+    return r->reads > 0 ? (double)r->sum_ns / r->reads : 0.0;
+}
+
+
+/*
+ * Return the median of the mean read time of the regions that were
+ * read.
+ */
+static double
+median_ns(const Scanmap *m)
+{
+    double *v = NEWZA(double, m->n > 0 ? m->n : 1);
+    double md = 0.0;
+    uint32_t i, n = 0;
+
+    for (i = 0; i < m->n; i++) {
+        if (m->r[i].reads > 0) v[n++] = mean_ns(&m->r[i]);
+    }
+
+    if (n > 0) {
+        qsort(v, n, sizeof v[0], cmpdbl);
+        md = v[n / 2];
+    }
+
+    DEL(v);
+    return md;
+}
+
+
+static int
+cmpdbl(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* EOF */
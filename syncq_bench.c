@@ -0,0 +1,385 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * syncq_bench.c - Microbenchmark for the producer-consumer queue
+ * used by the threaded copy engine.
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ * o  One producer thread and one consumer thread pass N elements
+ *    through a queue; we measure the throughput and the latency of
+ *    each element from enqueue to dequeue.
+ *
+ * o  We measure syncq.h (semaphores + mutex) and a lock free
+ *    single-producer/single-consumer ring (spins, then yields) for
+ *    a range of queue sizes, element sizes and CPU placement.
+ *
+ * o  copy_posix.c moves each buffer through two queues (io and
+ *    free); every thread does one enqueue and one dequeue per
+ *    buffer. So, the hand-off alone caps the copy at about
+ *    iosize * ops/sec / 2; we print that for 4k and 64k I/O.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "error.h"
+#include "utils/utils.h"
+#include "fast/syncq.h"
+#include "hist.h"
+
+
+// Largest queue we can test; the queues are sized at runtime up to
+// this.
+#define QMAX        1024
+
+/*
+ * Lock free single-producer/single-consumer ring. 'SZ' must be a
+ * power of 2. head and tail are free running counters on their own
+ * cache lines.
+ */
+struct __spsc {
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t mask __attribute__((aligned(64)));
+};
+
+#define SPSC_TYPEDEF(qtyp, objtyp, SZ)  struct qtyp {         \
+                                            struct __spsc s;  \
+                                            objtyp e[SZ];     \
+                                        };                    \
+                                        typedef struct qtyp qtyp
+
+#define SPSC_INIT(q0, SZ)   do { \
+                                (q0)->s.head = (q0)->s.tail = 0; \
+                                (q0)->s.mask = (SZ) - 1; \
+                            } while (0)
+
+#define SPSC_FINI(q0)       do { } while (0)
+
+#define SPSC_ENQ(q0, obj)   do { \
+                                typeof(q0) q_ = q0; \
+                                uint32_t t_ = q_->s.tail; \
+                                int n_ = 0; \
+                                while ((t_ - __atomic_load_n(&q_->s.head, __ATOMIC_ACQUIRE)) > q_->s.mask) \
+                                    backoff(&n_); \
+                                q_->e[t_ & q_->s.mask] = obj; \
+                                __atomic_store_n(&q_->s.tail, t_ + 1, __ATOMIC_RELEASE); \
+                            } while (0)
+
+#define SPSC_DEQ(q0)        ({ \
+                                typeof(q0) q_ = q0; \
+                                uint32_t h_ = q_->s.head; \
+                                int n_ = 0; \
+                                while (__atomic_load_n(&q_->s.tail, __ATOMIC_ACQUIRE) == h_) \
+                                    backoff(&n_); \
+                                typeof(q_->e[0]) z_ = q_->e[h_ & q_->s.mask]; \
+                                __atomic_store_n(&q_->s.head, h_ + 1, __ATOMIC_RELEASE); \
+                                z_; \
+                            })
+
+// Spin a little, then give up the CPU.
+static inline void
+backoff(int *n)
+{
+    if (++*n < 128) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        __asm__ __volatile__("" ::: "memory");
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+
+// CPU placement of the two threads
+#define PIN_NONE    0
+#define PIN_SAME    1   // both on CPU 0
+#define PIN_SPLIT   2   // producer on CPU 0, consumer on CPU 1
+
+static const char *Pinnames[] = { "none", "same", "split" };
+
+/*
+ * One benchmark run.
+ */
+struct bench {
+    uint32_t qsize;
+    uint64_t n;
+    int      pin;
+
+    void    *q;
+    Hist     lat;
+};
+typedef struct bench bench;
+
+static void pin_self(int cpu);
+
+
+/*
+ * Generate the queue types and the producer/consumer pair for an
+ * element of 'N' bytes and queue implementation 'Q'. The first word
+ * of each element carries its enqueue timestamp.
+ */
+#define ELEM(N)         struct e##N { uint64_t w[N/8]; }; typedef struct e##N e##N
+
+#define WORKERS(Q, N)                                                   \
+    Q##_TYPEDEF(Q##N, e##N, QMAX);                                      \
+                                                                        \
+    static void *                                                       \
+    Q##N##_prod(void *v)                                                \
+    {                                                                   \
+        bench *b = v;                                                   \
+        Q##N  *q = b->q;                                                \
+        e##N   e;                                                       \
+        uint64_t i;                                                     \
+                                                                        \
+        memset(&e, 0, sizeof e);                                        \
+        if (b->pin != PIN_NONE) pin_self(0);                            \
+        for (i = 0; i < b->n; i++) {                                    \
+            e.w[0] = timenow();                                         \
+            Q##_ENQ(q, e);                                              \
+        }                                                               \
+        return 0;                                                       \
+    }                                                                   \
+                                                                        \
+    static void *                                                       \
+    Q##N##_cons(void *v)                                                \
+    {                                                                   \
+        bench *b = v;                                                   \
+        Q##N  *q = b->q;                                                \
+        uint64_t i;                                                     \
+                                                                        \
+        if (b->pin != PIN_NONE) pin_self(b->pin == PIN_SPLIT ? 1 : 0);  \
+        for (i = 0; i < b->n; i++) {                                    \
+            e##N e = Q##_DEQ(q);                                        \
+            Hist_add(&b->lat, timenow() - e.w[0]);                      \
+        }                                                               \
+        return 0;                                                       \
+    }                                                                   \
+                                                                        \
+    static void                                                         \
+    Q##N##_setup(bench *b)                                              \
+    {                                                                   \
+        Q##N *q = malloc(sizeof *q);                                    \
+        if (!q) error(1, ENOMEM, "can't allocate queue");               \
+        Q##_INIT(q, b->qsize);                                          \
+        b->q = q;                                                       \
+    }                                                                   \
+                                                                        \
+    static void                                                         \
+    Q##N##_fini(bench *b)                                               \
+    {                                                                   \
+        Q##N *q = b->q;                                                 \
+        Q##_FINI(q);                                                    \
+        free(q);                                                        \
+    }
+
+ELEM(8);
+ELEM(64);
+ELEM(256);
+
+WORKERS(SYNCQ, 8)
+WORKERS(SYNCQ, 64)
+WORKERS(SYNCQ, 256)
+WORKERS(SPSC, 8)
+WORKERS(SPSC, 64)
+WORKERS(SPSC, 256)
+
+
+/*
+ * Table of queue x element size.
+ */
+struct impl {
+    const char *name;
+    uint32_t    esize;
+    void      (*setup)(bench *);
+    void      (*fini)(bench *);
+    void*     (*prod)(void *);
+    void*     (*cons)(void *);
+};
+
+#define IMPL(nm, Q, N)  { nm, N, Q##N##_setup, Q##N##_fini, Q##N##_prod, Q##N##_cons }
+
+static const struct impl Impls[] = {
+    IMPL("syncq", SYNCQ, 8),
+    IMPL("syncq", SYNCQ, 64),
+    IMPL("syncq", SYNCQ, 256),
+    IMPL("spsc",  SPSC,  8),
+    IMPL("spsc",  SPSC,  64),
+    IMPL("spsc",  SPSC,  256),
+};
+#define NIMPLS  (sizeof Impls / sizeof Impls[0])
+
+
+/*
+ * Run one benchmark and print a line of results.
+ */
+static void
+run(const struct impl *im, uint32_t qsize, int pin, uint64_t n)
+{
+    bench b;
+    pthread_t p, c;
+    int r;
+
+    memset(&b, 0, sizeof b);
+    b.qsize = qsize;
+    b.n     = n;
+    b.pin   = pin;
+
+    im->setup(&b);
+
+    uint64_t t0 = timenow();
+
+    if ((r = pthread_create(&c, 0, im->cons, &b)) != 0) error(1, r, "can't create consumer");
+    if ((r = pthread_create(&p, 0, im->prod, &b)) != 0) error(1, r, "can't create producer");
+
+    pthread_join(p, 0);
+    pthread_join(c, 0);
+
+    uint64_t t1 = timenow();
+    double ops  = (1.0e9 * n) / (t1 - t0);
+
+    im->fini(&b);
+
+    printf("%-6s %6" PRIu32 " %6" PRIu32 " %-6s %9.3f %8.1f %10" PRIu64 " %10" PRIu64 ""
+           " %10" PRIu64 " %10.0f %10.0f\n",
+           im->name, qsize, im->esize, Pinnames[pin], ops / 1.0e6, 1.0e9 / ops,
+           Hist_pct(&b.lat, 50.0), Hist_pct(&b.lat, 99.0), b.lat.max,
+           4096.0 * ops / 2 / 1.0e6, 65536.0 * ops / 2 / 1.0e6);
+}
+
+
+/*
+ * Pin the calling thread to 'cpu'; a no-op where we can't.
+ */
+static void
+pin_self(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t cs;
+
+    CPU_ZERO(&cs);
+    CPU_SET(cpu, &cs);
+    pthread_setaffinity_np(pthread_self(), sizeof cs, &cs);
+#else
+    (void)cpu;
+#endif
+}
+
+
+static void
+usage(void)
+{
+    printf("Usage: %s [-n N] [-q QSIZES] [-e ESIZES] [-p PINS] [-i QUEUES]\n"
+           "\n"
+           "Options:\n"
+           "  -n N       Elements to pass per run [1000000]\n"
+           "  -q LIST    Comma separated queue sizes; powers of 2 <= %d [2,8,32,128,1024]\n"
+           "  -e LIST    Element sizes: 8, 64, 256 [8,64,256]\n"
+           "  -p LIST    CPU placement: none, same, split [none,same,split]\n"
+           "  -i LIST    Queues: syncq, spsc [syncq,spsc]\n"
+           "\n"
+           "Latencies are enqueue to dequeue in ns. MB/s@4k and MB/s@64k are\n"
+           "the ceiling the hand-off alone puts on copy_posix.c at that iosize.\n",
+           program_name, QMAX);
+    exit(0);
+}
+
+
+// Return 1 if 'v' is in comma separated list 's'
+static int
+inlist(const char *s, const char *v)
+{
+    size_t n = strlen(v);
+
+    while (s && *s) {
+        if (strncmp(s, v, n) == 0 && (s[n] == ',' || s[n] == 0)) return 1;
+        s = strchr(s, ',');
+        if (s) s++;
+    }
+    return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    const char *qsizes = "2,8,32,128,1024";
+    const char *esizes = "8,64,256";
+    const char *pins   = "none,same,split";
+    const char *queues = "syncq,spsc";
+    uint64_t n         = 1000000;
+    int c;
+
+    program_name = argv[0];
+
+    while ((c = getopt(argc, argv, "n:q:e:p:i:h")) != -1) {
+        switch (c) {
+            case 'n': n      = strtoull(optarg, 0, 0); break;
+            case 'q': qsizes = optarg; break;
+            case 'e': esizes = optarg; break;
+            case 'p': pins   = optarg; break;
+            case 'i': queues = optarg; break;
+            default:  usage();
+        }
+    }
+
+    if (n == 0) die("number of elements must be > 0");
+
+    printf("%-6s %6s %6s %-6s %9s %8s %10s %10s %10s %10s %10s\n",
+           "queue", "qsize", "esize", "pin", "Mops/s", "ns/op",
+           "p50(ns)", "p99(ns)", "max(ns)", "MB/s@4k", "MB/s@64k");
+
+    const char *s = qsizes;
+    while (s && *s) {
+        uint32_t qsz = strtoul(s, 0, 0);
+        size_t i;
+        int p;
+
+        if (qsz == 0 || qsz > QMAX || (qsz & (qsz - 1)) != 0)
+            die("queue size %" PRIu32 " is not a power of 2 <= %d", qsz, QMAX);
+
+        for (i = 0; i < NIMPLS; i++) {
+            const struct impl *im = &Impls[i];
+            char es[16];
+
+            snprintf(es, sizeof es, "%" PRIu32, im->esize);
+            if (!inlist(queues, im->name) || !inlist(esizes, es)) continue;
+
+            for (p = PIN_NONE; p <= PIN_SPLIT; p++) {
+                if (!inlist(pins, Pinnames[p])) continue;
+
+                // Single CPU boxes can't split
+                if (p == PIN_SPLIT && sysconf(_SC_NPROCESSORS_ONLN) < 2) continue;
+
+                run(im, qsz, p, n);
+            }
+        }
+
+        s = strchr(s, ',');
+        if (s) s++;
+    }
+
+    return 0;
+}
+
+/* EOF */
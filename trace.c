@@ -0,0 +1,200 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * trace.c - timeline of pipeline events in Chrome trace format
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes
+ * =====
+ * Every thread that records events gets its own fixed size ring
+ * buffer; only that thread writes to it, so there are no locks or
+ * atomics in Trace_add(). When a ring fills up, the oldest events
+ * are overwritten and counted as dropped.
+ *
+ * The rings are dumped in the Chrome trace event format (load it
+ * in chrome://tracing or https://ui.perfetto.dev) once all the I/O
+ * threads are done.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "error.h"
+#include "utils/utils.h"
+#include "fastdd.h"
+
+struct tevent {
+    uint64_t t0,
+             t1;
+    uint32_t ev;
+};
+typedef struct tevent tevent;
+
+struct tring {
+    struct tring *next;
+
+    char     name[32];
+    uint32_t tid;
+    uint64_t n;         // events ever added; n & mask is the head
+    tevent  *ev;
+};
+typedef struct tring tring;
+
+struct tracer {
+    int      on;
+    uint64_t cap;       // events per ring (power of 2)
+    uint64_t start;
+
+    pthread_mutex_t lock;
+    tring   *rings;
+    uint32_t ntid;
+};
+
+// Names of each of the timed events
+const char *Evnames[EV_MAX] = {
+    "read", "write", "splice",
+    "free-deq", "io-enq", "io-deq", "free-enq", "pipe-wait",
+};
+
+static struct tracer T = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread tring *Ring = 0;
+
+static tring* newring(const char *name);
+
+
+/*
+ * Enable tracing with rings of 'nevents' each.
+ * Returns 0 on success, -errno on failure.
+ */
+int
+Trace_init(uint64_t nevents)
+{
+    if (nevents == 0) return -EINVAL;
+
+    T.cap   = NEXTPOW2(nevents);
+    T.start = timenow();
+    T.on    = 1;
+    return 0;
+}
+
+
+/*
+ * Name the calling thread in the trace.
+ */
+void
+Trace_thread(const char *name)
+{
+    if (!T.on) return;
+
+    if (Ring) {
+        strcopy(Ring->name, sizeof Ring->name, name);
+    } else {
+        Ring = newring(name);
+    }
+}
+
+
+/*
+ * Record event 'ev' that started at 't0' and ended at 't1'.
+ */
+void
+Trace_add(uint32_t ev, uint64_t t0, uint64_t t1)
+{
+    tring *r = Ring;
+
+    if (unlikely(!r)) {
+        if (!T.on) return;
+        r = Ring = newring("thread");
+    }
+
+    tevent *e = &r->ev[r->n & (T.cap - 1)];
+
+    e->t0 = t0;
+    e->t1 = t1;
+    e->ev = ev;
+    r->n++;
+}
+
+
+/*
+ * Write all the rings to 'fn' as Chrome trace JSON.
+ * Returns 0 on success, -errno on failure.
+ */
+int
+Trace_dump(const char *fn)
+{
+    uint64_t dropped = 0;
+    const char *sep  = "";
+    tring *r;
+
+    if (!T.on) return 0;
+
+    FILE *fp = fopen(fn, "w");
+    if (!fp) return -errno;
+
+    fprintf(fp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+
+    pthread_mutex_lock(&T.lock);
+    for (r = T.rings; r; r = r->next) {
+        uint64_t i = r->n > T.cap ? r->n - T.cap : 0;
+
+        dropped += i;
+
+        fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u"
+                    ", \"args\": {\"name\": \"%s\"}}", sep, r->tid, r->name);
+        sep = ",\n";
+
+        for (; i < r->n; i++) {
+            tevent *e = &r->ev[i & (T.cap - 1)];
+
+            fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u"
+                        ", \"ts\": %.3f, \"dur\": %.3f}",
+                        Evnames[e->ev], r->tid,
+                        (double)(e->t0 - T.start) / 1.0e3,
+                        (double)(e->t1 - e->t0) / 1.0e3);
+        }
+    }
+    pthread_mutex_unlock(&T.lock);
+
+    fprintf(fp, "\n], \"otherData\": {\"dropped\": %" PRIu64 "}}\n", dropped);
+
+    if (dropped > 0)
+        warn("trace: %" PRIu64 " events dropped; increase trace_size", dropped);
+
+    if (fclose(fp) != 0) return -errno;
+    return 0;
+}
+
+
+// Make a new ring for the calling thread
+static tring *
+newring(const char *name)
+{
+    tring *r = NEWZ(tring);
+    if (!r) error(1, ENOMEM, "can't allocate trace buffers");
+
+    r->ev = NEWA(tevent, T.cap);
+    if (!r->ev) error(1, ENOMEM, "can't allocate trace buffers");
+
+    strcopy(r->name, sizeof r->name, name);
+
+    pthread_mutex_lock(&T.lock);
+    r->tid  = ++T.ntid;
+    r->next = T.rings;
+    T.rings = r;
+    pthread_mutex_unlock(&T.lock);
+
+    return r;
+}
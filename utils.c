@@ -15,28 +15,67 @@
  */
 
 #include <unistd.h>
+#include <poll.h>
 //#include <sys/ioctl.h>
 //#include <sys/types.h>
 //#include <fcntl.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include "fastdd.h"
 
+__thread Syscnt Sc;
+
+/*
+ * Fold this thread's syscall counts into 'g'.
+ */
+void
+Acct_fold(Acctg *g)
+{
+    int i;
+
+    for (i = 0; i < SC_MAX; i++) {
+        __atomic_fetch_add(&g->nsyscalls,     Sc.calls[i],  __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g->sc.calls[i],   Sc.calls[i],  __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g->sc.bytes[i],   Sc.bytes[i],  __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g->sc.shorts[i],  Sc.shorts[i], __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&g->sc.waits,   Sc.waits,   __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g->sc.wait_ns, Sc.wait_ns, __ATOMIC_RELAXED);
+    memset(&Sc, 0, sizeof Sc);
+}
 
 /*
  * try very hard to read all n bytes of data from fd into buf.
  */
 ssize_t
 fullread(int fd, void *buf, size_t n)
+{
+    return fullread_timed(0, fd, buf, n);
+}
+
+
+/*
+ * fullread() that times each read(2) as LAT_RD in 'g' (if not 0);
+ * the waits for a nonblocking fd are not part of it.
+ */
+ssize_t
+fullread_timed(Acctg *g, int fd, void *buf, size_t n)
 {
     uint8_t *p = buf;
     size_t   r = n;
 
     while (r > 0) {
-        ssize_t m = read(fd, p, r);
+        ssize_t m;
+
+        if (g) TIMED(g, LAT_RD, m = read(fd, p, r));
+        else   m = read(fd, p, r);
+        Sc_count(SC_IN, r, m);
         if (m < 0) {
             int err = errno;
-            if (err == EINTR || err == EAGAIN) continue;
+            if (err == EINTR) continue;
+            if (err == EAGAIN && (err = -Io_wait(fd, POLLIN)) == 0) continue;
             return -err;
         }
         if (m == 0) return n - r;
@@ -53,15 +92,30 @@ fullread(int fd, void *buf, size_t n)
  */
 ssize_t
 fullwrite(int fd, void *buf, size_t n)
+{
+    return fullwrite_timed(0, fd, buf, n);
+}
+
+
+/*
+ * fullwrite() that times each write(2) as LAT_WR in 'g' (if not 0).
+ */
+ssize_t
+fullwrite_timed(Acctg *g, int fd, void *buf, size_t n)
 {
     uint8_t *p = buf;
     size_t   r = n;
 
     while (r > 0) {
-        ssize_t m = write(fd, p, r);
+        ssize_t m;
+
+        if (g) TIMED(g, LAT_WR, m = write(fd, p, r));
+        else   m = write(fd, p, r);
+        Sc_count(SC_OUT, r, m);
         if (m < 0) {
             int err = errno;
-            if (err == EINTR || err == EAGAIN) continue;
+            if (err == EINTR) continue;
+            if (err == EAGAIN && (err = -Io_wait(fd, POLLOUT)) == 0) continue;
             return -err;
         }
         if (m == 0) return n - r;
@@ -73,6 +127,29 @@ fullwrite(int fd, void *buf, size_t n)
 }
 
 
+/*
+ * Block until nonblocking 'fd' is ready for 'events' (POLLIN or
+ * POLLOUT) after a syscall on it failed with EAGAIN; retrying right
+ * away would spin a core while the other end is slow. An error or
+ * hangup counts as ready: the retry reports it. The wait is counted
+ * in this thread's Sc. Return 0 on success, -errno on failure.
+ */
+int
+Io_wait(int fd, short events)
+{
+    struct pollfd p = { .fd = fd, .events = events };
+    uint64_t t0 = timenow();
+    int r;
+
+    while ((r = poll(&p, 1, -1)) < 0 && errno == EINTR)
+        ;
+
+    Sc.waits++;
+    Sc.wait_ns += timenow() - t0;
+    return r < 0 ? -errno : 0;
+}
+
+
 /*
  * Skip reading 'n' initial bytes. We can't lseek(2) because fd is a
  * pipe.
@@ -95,3 +172,84 @@ skip(int fd, uint64_t n)
     return n;
 }
 
+
+
+/*
+ * Skip the first 'n' bytes of the logical (concatenated) input.
+ * Inputs that are entirely skipped are stepped over; the input
+ * where the skip ends is made current and positioned just past the
+ * skipped bytes.
+ * Returns 0 on success, -errno on failure.
+ */
+int
+skip_input(Args *a, uint64_t n)
+{
+    if (a->gen.type != GEN_NONE) {
+        Gen_skip(&a->gen, n);
+        return 0;
+    }
+
+    while (n > 0) {
+        if (a->ipipe) {
+            ssize_t r = skip(a->ifd, n);
+            if (r < 0) return r;
+
+            n -= r;
+        } else if (S_ISREG(a->ist.st_mode) || S_ISBLK(a->ist.st_mode)) {
+            uint64_t sz = a->ist.st_size;
+
+            if (n < sz || a->curin == (a->ninputs - 1)) {
+                Sc.calls[SC_SEEK]++;
+                if (lseek(a->ifd, n, SEEK_SET) < 0) return -errno;
+                return 0;
+            }
+            n -= sz;
+        } else {
+            // char devices and such have no notion of size
+            Sc.calls[SC_SEEK]++;
+            if (lseek(a->ifd, n, SEEK_SET) < 0) return -errno;
+            return 0;
+        }
+
+        if (n > 0 && Next_input(a) < 0) return 0;
+    }
+    return 0;
+}
+
+
+/*
+ * Print the device topology in 'd'.
+ */
+void
+Devinfo_print(FILE *fp, const Devinfo *d)
+{
+    static const char *rot[] = { "unknown", "no (solid state)", "yes" };
+
+    fprintf(fp, "    device:        %s\n", d->name[0] ? d->name : "?");
+    fprintf(fp, "    sector size:   %u logical, %u physical\n", d->lbs, d->pbs);
+    fprintf(fp, "    io size:       %u min, %u optimal, %u max\n", d->iomin, d->ioopt, d->maxio);
+    fprintf(fp, "    discard:       %u bytes granularity%s\n", d->discard,
+                d->dzeroes ? "; reads back zeros" : "");
+    fprintf(fp, "    write zeroes:  %" PRIu64 " bytes max\n", d->wzmax);
+    fprintf(fp, "    nr_requests:   %u\n", d->nr_requests);
+    fprintf(fp, "    rotational:    %s\n", rot[d->rotational + 1]);
+}
+
+
+/*
+ * Return true if all 'n' bytes at 'p' are zero. Once the first 16
+ * bytes are known to be zero, the buffer is zero iff it equals
+ * itself shifted by 16; memcmp() is vectorized by libc.
+ */
+int
+iszero(const void *p, size_t n)
+{
+    const uint8_t *b = p;
+    size_t i, k = n < 16 ? n : 16;
+
+    for (i = 0; i < k; i++) {
+        if (b[i]) return 0;
+    }
+    return n <= 16 || 0 == memcmp(b, b + 16, n - 16);
+}
+
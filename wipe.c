@@ -0,0 +1,464 @@
+/* vim: expandtab:tw=68:ts=4:sw=4:
+ *
+ * wipe.c - the wipe mode: fill a range of the output with zeros or
+ *          a pattern as fast as the device allows.
+ *
+ * Copyright (c) 2015 Sudhi Herle <sw at herle.net>
+ *
+ * Licensing Terms: GPLv2
+ *
+ * If you need a commercial license for this work, please contact
+ * the author.
+ *
+ * This software does not come with any express or implied
+ * warranty; it is provided "as is". No claim  is made to its
+ * suitability for any purpose.
+ *
+ * Notes:
+ * ======
+ *
+ * o  The WIPE_xxx tiers are tried in order. A tier that can't
+ *    start hands the whole range to the next one; one that fails
+ *    part way hands over the rest. Each batch of an offload is at
+ *    most WIPE_BATCH bytes so that progress keeps moving.
+ *
+ * o  A discard only counts as a zero fill when the device promises
+ *    zeros after it (BLKDISCARDZEROES); reading back a few sectors
+ *    proves nothing. Otherwise the range is trimmed first (reported
+ *    as discarded, not wiped) and then zeroed by the next tiers.
+ *
+ * o  BLKZEROOUT is only used when the device zeroes without a data
+ *    transfer (write_zeroes); otherwise the kernel writes zero pages
+ *    one request at a time and our own writes are faster.
+ *
+ * o  The last tier has several threads each claim the next chunk of
+ *    the range and write it. Zeros come from one buffer filled up
+ *    front; any other fill is generated per chunk at its offset, so
+ *    the range holds the same stream as a copy from the generator.
+ */
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "utils/new.h"
+#include "fastdd.h"
+#include "probes.h"
+
+// Largest single offload request
+#define WIPE_BATCH      (1024ULL * 1048576)
+
+// Size of the pre-built buffer and of each write
+#define WIPE_CHUNK      (4 * 1048576)
+
+// Max writer threads
+#define WIPE_THREADS    32
+
+const char *Wipenames[WIPE_MAX] = {
+    "secdiscard", "discard", "zeroout", "zero-range", "write",
+};
+
+struct tier
+{
+    // Return 0 if the tier can fill 'a', else the reason it can't
+    const char * (*unusable)(Args *a);
+};
+typedef struct tier tier;
+
+static const char *trim_unusable(Args *a);
+static const char *discard_unusable(Args *a);
+static const char *zeroout_unusable(Args *a);
+static const char *zerorange_unusable(Args *a);
+static const char *write_unusable(Args *a);
+
+static const tier Tiers[WIPE_MAX] =
+{
+      {discard_unusable}
+    , {discard_unusable}
+    , {zeroout_unusable}
+    , {zerorange_unusable}
+    , {write_unusable}
+};
+
+struct wiper
+{
+    Args  *args;
+    Acctg *acc;
+
+    const uint8_t *buf; // WIPE_CHUNK (or iosize) zeros; 0 => generate each chunk
+    uint64_t next;      // offset of the next unclaimed chunk
+    uint64_t end;
+    uint64_t io;
+    int      nthr;
+
+    int err;            // first write error (errno)
+
+    pthread_mutex_t lock;   // serializes the fold into 'acc'
+};
+typedef struct wiper wiper;
+
+static uint64_t offload(Acctg *g, Args *a, int t, uint64_t off, uint64_t end);
+static void     trim(Acctg *g, Args *a, uint64_t off, uint64_t end);
+static void     wipe_write(Acctg *g, Args *a, uint64_t off, uint64_t end);
+static void    *wipe_thread(void *v);
+static int      nthreads(Args *a);
+static uint64_t chunksize(Args *a);
+
+
+int
+Wipe(Acctg *g, Args *a)
+{
+    uint64_t off = a->seek;
+    uint64_t end = a->seek + a->insize;
+    int t;
+
+    Trace_thread("wipe");
+
+    g->engine = "wipe";
+
+    if (discard_unusable(a) && !trim_unusable(a)) trim(g, a, off, end);
+
+    for (t = 0; t < WIPE_WRITE && off < end; t++) {
+        if (Tiers[t].unusable(a)) continue;
+
+        off = offload(g, a, t, off, end);
+    }
+
+    Acct_fold(g);
+
+    if (off < end) wipe_write(g, a, off, end);
+    return 0;
+}
+
+
+void
+Wipe_explain(FILE *fp, Args *a)
+{
+    const char *fill = a->gen.type == GEN_ZERO    ? "zeros" :
+                       a->gen.type == GEN_PATTERN ? "pattern" : "random";
+    int t;
+
+    fprintf(fp, "mode:      wipe\n");
+    fprintf(fp, "range:     %" PRIu64 " bytes at offset %" PRIu64 "\n", a->insize, a->seek);
+    fprintf(fp, "fill:      %s\n", fill);
+    fprintf(fp, "iosize:    %" PRIu64 " bytes\n", chunksize(a));
+    fprintf(fp, "threads:   %d\n", nthreads(a));
+
+    fprintf(fp, "tiers:\n");
+    for (t = 0; t < WIPE_MAX; t++) {
+        const char *r = Tiers[t].unusable(a);
+
+        fprintf(fp, "    %-10s %s%s\n", Wipenames[t], r ? "no: " : "usable", r ? r : "");
+    }
+
+    if (discard_unusable(a) && !trim_unusable(a))
+        fprintf(fp, "trim:      discard first; it doesn't count as wiped\n");
+}
+
+
+/*
+ * Fill [off, end) with tier 't' and return the offset where it
+ * stopped.
+ */
+static uint64_t
+offload(Acctg *g, Args *a, int t, uint64_t off, uint64_t end)
+{
+    while (off < end) {
+        uint64_t n = end - off > WIPE_BATCH ? WIPE_BATCH : end - off;
+        int r;
+
+        PROBE2(write__start, a->ofd, n);
+        TIMED(g, LAT_WR, r = Wipe_offload(a, t, off, n));
+        Sc_count(SC_OUT, n, r == 0 ? (ssize_t)n : -1);
+        PROBE2(chunk__write, a->ofd, n);
+
+        if (r < 0) {
+            Verbose("wipe: %s at offset %" PRIu64 ": %s\n", Wipenames[t], off, strerror(-r));
+            break;
+        }
+
+        Acct_add(&g->nwr, n);
+        g->wiped[t] += n;
+        off += n;
+    }
+    return off;
+}
+
+
+/*
+ * Trim [off, end) with secdiscard, else discard, on a device that
+ * doesn't promise zeros afterwards; the range still has to be
+ * zeroed.
+ */
+static void
+trim(Acctg *g, Args *a, uint64_t off, uint64_t end)
+{
+    int t = WIPE_SECDISCARD;
+
+    while (off < end) {
+        uint64_t n = end - off > WIPE_BATCH ? WIPE_BATCH : end - off;
+        int r;
+
+        TIMED(g, LAT_WR, r = Wipe_offload(a, t, off, n));
+        Sc_count(SC_OUT, n, r == 0 ? (ssize_t)n : -1);
+
+        if (r < 0) {
+            Verbose("wipe: trim with %s at offset %" PRIu64 ": %s\n", Wipenames[t], off, strerror(-r));
+            if (t == WIPE_DISCARD) break;
+            t = WIPE_DISCARD;
+            continue;
+        }
+
+        Acct_add(&g->discarded, n);
+        off += n;
+    }
+}
+
+
+static void
+wipe_write(Acctg *g, Args *a, uint64_t off, uint64_t end)
+{
+    size_t pg = sysconf(_SC_PAGESIZE);
+    void *buf = 0;
+    int i, n = nthreads(a);
+    pthread_t *id = NEWZA(pthread_t, n);
+
+    wiper w = {
+        .args = a,
+        .acc  = g,
+        .next = off,
+        .end  = end,
+        .io   = chunksize(a),
+        .nthr = n,
+    };
+
+    int r;
+
+    if (a->gen.type == GEN_ZERO) {
+        r = posix_memalign(&buf, a->align > pg ? a->align : pg, w.io);
+        if (r != 0) error(1, r, "can't allocate wipe buffer");
+
+        memset(buf, 0, w.io);
+        w.buf = buf;
+    }
+
+    g->iosize = w.io;
+    g->bufmem = w.buf ? w.io : n * w.io;
+    g->qsize  = n;
+
+    pthread_mutex_init(&w.lock, 0);
+
+    for (i = 0; i < n; i++) {
+        r = pthread_create(&id[i], 0, wipe_thread, &w);
+        if (r != 0) error(1, r, "can't create wipe thread %d", i);
+    }
+
+    for (i = 0; i < n; i++) pthread_join(id[i], 0);
+
+    pthread_mutex_destroy(&w.lock);
+    free(buf);
+    DEL(id);
+
+    if (w.err != 0) {
+        Reporter_stop(0);
+        error(1, w.err, "write error on %s", a->outfile);
+    }
+
+    g->wiped[WIPE_WRITE] = end - off;
+}
+
+
+static void *
+wipe_thread(void *v)
+{
+    wiper *w = v;
+    Args  *a = w->args;
+    Acctg *g = w->acc;
+    size_t pg = sysconf(_SC_PAGESIZE);
+    const uint8_t *p = w->buf;
+    void  *buf = 0;
+    Ratelimit rl;
+    Acctg  l;       // this thread's latencies
+    int r;
+
+    memset(&l, 0, sizeof l);
+    l.timing  = g->timing;
+    l.tracing = g->tracing;
+
+    Ratelimit_init(&rl, a->rate / w->nthr, a->burst / w->nthr);
+
+    Trace_thread("wipe");
+
+    if (!p) {
+        r = posix_memalign(&buf, a->align > pg ? a->align : pg, w->io);
+        if (r != 0) error(1, r, "can't allocate wipe buffer");
+        p = buf;
+    }
+
+    while (!__atomic_load_n(&w->err, __ATOMIC_RELAXED)) {
+        uint64_t off = __atomic_fetch_add(&w->next, w->io, __ATOMIC_RELAXED);
+        if (off >= w->end) break;
+
+        size_t  m = w->end - off < w->io ? w->end - off : w->io;
+        size_t  k;
+        ssize_t z;
+
+        if (buf) {
+            Gen gg = a->gen;
+
+            Gen_seek(&gg, off - a->seek);
+            Gen_fill(&gg, buf, m);
+        }
+
+        PROBE2(write__start, a->ofd, m);
+        for (k = 0; k < m; ) {
+            TIMED(&l, LAT_WR, z = pwrite(a->ofd, p + k, m - k, off + k));
+            Sc_count(SC_OUT, m - k, z);
+            if (z < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if (z <= 0) {
+                int err = z < 0 ? errno : EIO;
+
+                __atomic_compare_exchange_n(&w->err, &(int){0}, err, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+                break;
+            }
+            k += z;
+        }
+        PROBE2(chunk__write, a->ofd, k);
+
+        if (k < m) break;
+
+        __atomic_fetch_add(&g->nwr, m, __ATOMIC_RELAXED);
+        Ratelimit(&rl, m);
+    }
+
+    free(buf);
+
+    pthread_mutex_lock(&w->lock);
+    for (r = 0; r < LAT_MAX; r++) Hist_merge(&g->lat[r], &l.lat[r]);
+    for (r = 0; r < EV_MAX; r++)  Acct_add(&g->busy_ns[r], l.busy_ns[r]);
+    pthread_mutex_unlock(&w->lock);
+
+    Acct_fold(g);
+    return 0;
+}
+
+
+/*
+ * A spinning disk gets one sequential stream; everything else as
+ * many writes in flight as the device queue takes.
+ */
+static int
+nthreads(Args *a)
+{
+    int n = a->qdepth < WIPE_THREADS ? a->qdepth : WIPE_THREADS;
+
+    if (a->rotational == 1 || n < 1) n = 1;
+    return n;
+}
+
+
+/*
+ * Rate limited wipes keep to iosize (it fits the burst); none
+ * needs a buffer larger than the range.
+ */
+static uint64_t
+chunksize(Args *a)
+{
+    uint64_t pg = sysconf(_SC_PAGESIZE);
+    uint64_t io = a->rate > 0 || a->iosize >= WIPE_CHUNK ? a->iosize : WIPE_CHUNK;
+
+    if (io > a->insize) io = (a->insize + pg - 1) & ~(pg - 1);
+    return io;
+}
+
+
+/*
+ * The offloads are for zero fills; they don't go through the token
+ * bucket.
+ */
+static const char *
+offload_unusable(Args *a)
+{
+#ifdef __linux__
+    if (a->gen.type != GEN_ZERO) return "fill is not zeros";
+    if (a->rate > 0)             return "rate limited";
+    return 0;
+#else
+    (void)a;
+    return "linux only";
+#endif
+}
+
+
+/*
+ * Block devices take whole logical sectors.
+ */
+static const char *
+blkdev_unusable(Args *a)
+{
+    uint64_t lbs = a->odev.lbs ? a->odev.lbs : 512;
+    const char *r = offload_unusable(a);
+
+    if (r) return r;
+    if (!S_ISBLK(a->ost.st_mode))          return "output is not a block device";
+    if ((a->seek | a->insize) & (lbs - 1)) return "range is not sector aligned";
+    return 0;
+}
+
+
+static const char *
+trim_unusable(Args *a)
+{
+    const char *r = blkdev_unusable(a);
+
+    if (r) return r;
+    if (a->odev.discard == 0)     return "device can't discard";
+    return 0;
+}
+
+
+static const char *
+discard_unusable(Args *a)
+{
+    const char *r = trim_unusable(a);
+
+    if (r) return r;
+    if (!a->odev.dzeroes)         return "device doesn't promise zeros after a discard; trim only";
+    return 0;
+}
+
+
+static const char *
+zeroout_unusable(Args *a)
+{
+    const char *r = blkdev_unusable(a);
+
+    if (r) return r;
+    if (a->odev.wzmax == 0)       return "device can't offload write zeroes";
+    return 0;
+}
+
+
+static const char *
+zerorange_unusable(Args *a)
+{
+    const char *r = offload_unusable(a);
+
+    if (r) return r;
+    if (!S_ISREG(a->ost.st_mode)) return "output is not a regular file";
+    return 0;
+}
+
+
+static const char *
+write_unusable(Args *a)
+{
+    (void)a;
+    return 0;
+}
+
+/* EOF */